@@ -3,13 +3,35 @@
 #include <linux/kernel.h>
 #include <linux/io.h>
 #include <linux/interrupt.h>
+#include <linux/sched.h>
 #include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
 #include <linux/clk.h>
 #include <linux/regulator/consumer.h>
+#include <linux/gpio/consumer.h>
+#include <linux/pm_wakeup.h>
+#include <linux/pm_qos.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
+#include <linux/rculist.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
 
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
 #include <linux/iio/driver.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/kfifo_buf.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+
+#include "imx6ull_adc_ioctl.h"
 
 #define IMX6ULL_ADC_NAME "imx6ull-adc"
 
@@ -39,6 +61,7 @@
 #define IMX6ULL_ADC_CLK_MASK		0x60
 #define IMX6ULL_ADC_ADLSMP_LONG		0x10
 #define IMX6ULL_ADC_ADSTS_MASK		0x300
+#define IMX6ULL_ADC_ADSTS(x)		(((x) & 0x3) << 8)
 #define IMX6ULL_ADC_ADLPC_EN		0x80
 #define IMX6ULL_ADC_ADHSC_EN		0x400
 #define IMX6ULL_ADC_REFSEL_VALT		0x100
@@ -50,6 +73,9 @@
 #define IMX6ULL_ADC_AVGS_MASK		0xC000
 #define IMX6ULL_ADC_OVWREN		0x10000
 
+/* General status register field define */
+#define IMX6ULL_ADC_ADACT			0x1
+
 /* General control register field define */
 #define IMX6ULL_ADC_ADACKEN		0x1
 #define IMX6ULL_ADC_DMAEN			0x2
@@ -66,8 +92,66 @@
 #define IMX6ULL_ADC_CONV_DISABLE		0x1F
 #define IMX6ULL_ADC_HS_COCO0		0x1
 #define IMX6ULL_ADC_CALF			0x2
+#define IMX6ULL_ADC_CV1(x)			((x) & 0xFFF)
+#define IMX6ULL_ADC_CV2(x)			(((x) & 0xFFF) << 16)
 #define IMX6ULL_ADC_TIMEOUT		msecs_to_jiffies(100)
 
+/* 单次转换超时 = 2 倍理论转换时间 + 中断延迟余量 */
+#define IMX6ULL_ADC_TIMEOUT_MARGIN_US	50
+/* 超时不超过这个值时忙等，否则睡眠等待 */
+#define IMX6ULL_ADC_SPIN_MAX_US		200
+
+/* 上半部锁存结果的队列长度 (2 的幂)，和下半部线程的默认实时优先级 */
+#define IMX6ULL_ADC_RAW_SIZE		256
+#define IMX6ULL_ADC_IRQ_PRIO_DEF	(MAX_USER_RT_PRIO / 2)
+
+/*
+ * 运行时 ADCK 的上限，和 vf610 同一个 ADC 模块: 低功耗 (ADLPC=1) 20MHz，
+ * 普通模式 30MHz；40MHz 要开 ADHSC，imx6ull_adc_cfg_set() 不开
+ */
+#define IMX6ULL_ADC_ADCK_MAX_LP		20000000
+#define IMX6ULL_ADC_ADCK_MAX_NORMAL	30000000
+
+/* 设备自带 hrtimer 触发器的默认频率 */
+#define IMX6ULL_ADC_TRIG_DEF_FREQ	1000
+
+/*
+ * 流式采集申请 CPU 延迟上限时，超过这个值就不申请了：i.MX6ULL 最深的
+ * cpuidle 状态退出延迟也只有几百微秒，再宽的上限不会挡住任何状态
+ */
+#define IMX6ULL_ADC_QOS_MAX_US		1000
+
+/* Goertzel 单频检测器个数，和每块样本数的默认值、范围 */
+#define IMX6ULL_ADC_TONES		4
+#define IMX6ULL_ADC_TONE_DEF_LEN	256
+#define IMX6ULL_ADC_TONE_MIN_LEN	8
+#define IMX6ULL_ADC_TONE_MAX_LEN	512
+#define IMX6ULL_ADC_TONE_MAX_FREQ	1000000
+
+/*
+ * 交流计量: 一个周期至少这么多个扫描才算数 (滤掉噪声造成的假过零)，
+ * 超过最大值还没有过零时放弃这一周期，累加和不会溢出
+ */
+#define IMX6ULL_ADC_METER_MIN_SCANS	8
+#define IMX6ULL_ADC_METER_MAX_SCANS	(1 << 20)
+
+/*
+ * 精度规划用的噪声模型，单位是半个有效位:
+ * 12 位模式下单次转换的 ENOB 约 10.5 位，白噪声假设下
+ * 平均 N 次多 log2(N)/2 位，硬件平均和软件过采样一样计算
+ */
+#define IMX6ULL_ADC_BASE_ENOB_HB	21
+
+/* 自适应采样率: burst 档安静多少次扫描后降回 base 档 */
+#define IMX6ULL_ADC_ADAPT_DEF_HOLD	64
+
+/* 校准失败后的重试: 50ms 起每次翻倍，最多 5 次 */
+#define IMX6ULL_ADC_CAL_BACKOFF_MS	50
+#define IMX6ULL_ADC_CAL_RETRIES		5
+
+/* bandgap 比例模式下两次测量参考电压的最短间隔 */
+#define IMX6ULL_ADC_REF_REFRESH		msecs_to_jiffies(1000)
+
 #define IMX6ULL_ADC_CHAN(_idx, _chan_type) {			\
 	.type = (_chan_type),					\
 	.indexed = 1,						\
@@ -75,6 +159,14 @@
 	.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),		\
 	.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE) |	\
 				BIT(IIO_CHAN_INFO_SAMP_FREQ),	\
+	.ext_info = imx6ull_adc_ext_info,			\
+	.scan_index = (_idx),					\
+	.scan_type = {						\
+		.sign = 'u',					\
+		.realbits = 12,					\
+		.storagebits = 16,				\
+		.endianness = IIO_CPU,				\
+	},							\
 }
 
 enum clk_sel {
@@ -89,6 +181,34 @@ enum vol_ref {
 	IMX6ULL_ADCIOC_VR_VBG_SET,
 };
 
+/*
+ * scale 用的参考电压:
+ * vrefh:   vref 调节器的标称电压
+ * bandgap: 转换一个已知电压的通道，按比例反推 VREFH 的实际电压
+ */
+enum ref_mode {
+	IMX6ULL_ADC_REF_VREFH,
+	IMX6ULL_ADC_REF_BANDGAP,
+};
+
+enum glitch_mode {
+	IMX6ULL_ADC_GLITCH_NONE,
+	IMX6ULL_ADC_GLITCH_MEDIAN,
+	IMX6ULL_ADC_GLITCH_SLEW,
+};
+
+enum glitch_attr {
+	IMX6ULL_ADC_GLITCH_THRESHOLD,
+	IMX6ULL_ADC_GLITCH_REJECTED,
+};
+
+enum profile_attr {
+	IMX6ULL_ADC_PROF_SAMPLE,
+	IMX6ULL_ADC_PROF_SAMPLE_AVAIL,
+	IMX6ULL_ADC_PROF_AVG,
+	IMX6ULL_ADC_PROF_AVG_AVAIL,
+};
+
 enum average_sel {
 	IMX6ULL_ADC_SAMPLE_1,
 	IMX6ULL_ADC_SAMPLE_4,
@@ -112,28 +232,523 @@ struct imx6ull_adc_feature {
 
 static const u32 imx6ull_hw_avgs[] = { 1, 4, 8, 16, 32 };
 
+/*
+ * 采样时间 (ADCK 周期): 下标 0~3 是短采样 (ADLSMP=0)，
+ * 4~7 是长采样 (ADLSMP=1)，低两位是 ADSTS
+ */
+static const u32 imx6ull_sample_cycles[] = { 2, 4, 6, 8, 12, 16, 20, 24 };
+
+/*
+ * 软件过采样倍率，每 4 倍过采样多出 1 位有效分辨率：
+ * 1, 4, 16, 64, 256 分别对应 12, 13, 14, 15, 16 位输出
+ */
+static const u32 imx6ull_osr_avail[] = { 1, 4, 16, 64, 256 };
+
+static int imx6ull_adc_get_glitch_mode(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan);
+static int imx6ull_adc_set_glitch_mode(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan,
+				unsigned int mode);
+static ssize_t imx6ull_adc_read_glitch(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan, char *buf);
+static ssize_t imx6ull_adc_write_glitch(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan,
+				const char *buf, size_t len);
+static ssize_t imx6ull_adc_read_profile(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan, char *buf);
+static ssize_t imx6ull_adc_write_profile(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan,
+				const char *buf, size_t len);
+static ssize_t imx6ull_adc_read_lost(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan, char *buf);
+static int imx6ull_adc_get_ref_mode(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan);
+static int imx6ull_adc_set_ref_mode(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan,
+				unsigned int mode);
+static ssize_t imx6ull_adc_read_ref_uv(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan, char *buf);
+
+static const char * const imx6ull_glitch_modes[] = {
+	[IMX6ULL_ADC_GLITCH_NONE] = "none",
+	[IMX6ULL_ADC_GLITCH_MEDIAN] = "median",
+	[IMX6ULL_ADC_GLITCH_SLEW] = "slew",
+};
+
+static const struct iio_enum imx6ull_glitch_mode_enum = {
+	.items = imx6ull_glitch_modes,
+	.num_items = ARRAY_SIZE(imx6ull_glitch_modes),
+	.get = imx6ull_adc_get_glitch_mode,
+	.set = imx6ull_adc_set_glitch_mode,
+};
+
+static const char * const imx6ull_ref_modes[] = {
+	[IMX6ULL_ADC_REF_VREFH] = "vrefh",
+	[IMX6ULL_ADC_REF_BANDGAP] = "bandgap",
+};
+
+static const struct iio_enum imx6ull_ref_mode_enum = {
+	.items = imx6ull_ref_modes,
+	.num_items = ARRAY_SIZE(imx6ull_ref_modes),
+	.get = imx6ull_adc_get_ref_mode,
+	.set = imx6ull_adc_set_ref_mode,
+};
+
+static const struct iio_chan_spec_ext_info imx6ull_adc_ext_info[] = {
+	IIO_ENUM("glitch_filter", IIO_SEPARATE, &imx6ull_glitch_mode_enum),
+	IIO_ENUM_AVAILABLE("glitch_filter", &imx6ull_glitch_mode_enum),
+	{
+		.name = "glitch_threshold",
+		.shared = IIO_SEPARATE,
+		.read = imx6ull_adc_read_glitch,
+		.write = imx6ull_adc_write_glitch,
+		.private = IMX6ULL_ADC_GLITCH_THRESHOLD,
+	},
+	{
+		.name = "glitch_rejected",
+		.shared = IIO_SEPARATE,
+		.read = imx6ull_adc_read_glitch,
+		.private = IMX6ULL_ADC_GLITCH_REJECTED,
+	},
+	{
+		.name = "lost_samples",
+		.shared = IIO_SEPARATE,
+		.read = imx6ull_adc_read_lost,
+	},
+	{
+		.name = "sample_cycles",
+		.shared = IIO_SEPARATE,
+		.read = imx6ull_adc_read_profile,
+		.write = imx6ull_adc_write_profile,
+		.private = IMX6ULL_ADC_PROF_SAMPLE,
+	},
+	{
+		.name = "sample_cycles_available",
+		.shared = IIO_SHARED_BY_TYPE,
+		.read = imx6ull_adc_read_profile,
+		.private = IMX6ULL_ADC_PROF_SAMPLE_AVAIL,
+	},
+	{
+		.name = "hw_average",
+		.shared = IIO_SEPARATE,
+		.read = imx6ull_adc_read_profile,
+		.write = imx6ull_adc_write_profile,
+		.private = IMX6ULL_ADC_PROF_AVG,
+	},
+	{
+		.name = "hw_average_available",
+		.shared = IIO_SHARED_BY_TYPE,
+		.read = imx6ull_adc_read_profile,
+		.private = IMX6ULL_ADC_PROF_AVG_AVAIL,
+	},
+	IIO_ENUM("reference", IIO_SHARED_BY_TYPE, &imx6ull_ref_mode_enum),
+	IIO_ENUM_AVAILABLE("reference", &imx6ull_ref_mode_enum),
+	{
+		.name = "reference_microvolt",
+		.shared = IIO_SHARED_BY_TYPE,
+		.read = imx6ull_adc_read_ref_uv,
+	},
+	{ }
+};
+
 static const struct iio_chan_spec imx6ull_adc_iio_channels[] = {
 	IMX6ULL_ADC_CHAN(0, IIO_VOLTAGE),
 	IMX6ULL_ADC_CHAN(1, IIO_VOLTAGE),
 };
 
+#define IMX6ULL_ADC_MAX_CHANNELS	ARRAY_SIZE(imx6ull_adc_iio_channels)
+
+/*
+ * 通道配置: 采样时间和硬件平均可以按通道单独设置，
+ * 转换这个通道前只改 CFG/GC 里的这些位
+ */
+#define IMX6ULL_ADC_PROF_CFG_MASK	(IMX6ULL_ADC_ADLSMP_LONG | \
+					IMX6ULL_ADC_ADSTS_MASK | \
+					IMX6ULL_ADC_AVGS_MASK)
+#define IMX6ULL_ADC_PROF_GC_MASK	IMX6ULL_ADC_AVGEN
+
+struct imx6ull_adc_profile {
+	int sample_idx;		/* imx6ull_sample_cycles 下标 */
+	int avg_idx;		/* imx6ull_hw_avgs 下标，-1 跟随 sampling_frequency */
+};
+
+struct imx6ull_adc_prof_regs {
+	u32 cfg_mask;
+	u32 cfg_bits;
+	u32 gc_mask;
+	u32 gc_bits;
+};
+
+/*
+ * 热路径 (中断、读取) 使用的配置快照
+ * 由 adc_feature 生成，通过 RCU 发布，发布后只读不改；
+ * 中断和读路径不用拿 info->lock 也能看到一份完整的配置
+ */
+struct imx6ull_adc_config {
+	int	sample_rate;
+	int	res_mode;
+	int	osr_idx;
+	u32	samp_freq;
+	u32	conv_timeout_us;
+
+	/* 各通道一次转换的时间，连续转换模式下用来估算丢失的结果 */
+	u32	conv_ns[IMX6ULL_ADC_MAX_CHANNELS];
+
+	/* 预先算好的取数掩码和抽取参数，中断里不再按 res_mode 分支 */
+	u32	data_mask;
+	u32	osr_ratio;
+	int	cic_shift;
+	bool	pack8;
+
+	/* 对应的 CFG/GC 寄存器值 */
+	u32	cfg_reg;
+	u32	gc_reg;
+
+	/* 各通道配置在全局设置上要覆盖的位 */
+	struct imx6ull_adc_prof_regs prof[IMX6ULL_ADC_MAX_CHANNELS];
+
+	struct rcu_head rcu;
+};
+
+/*
+ * 一次扫描: 每通道 16 位数据，8 字节对齐后再放 64 位时间戳
+ * 状态字不是 IIO 通道，只写进字符设备的环形缓冲记录
+ */
+#define IMX6ULL_ADC_SCAN_WORDS	(ALIGN(IMX6ULL_ADC_MAX_CHANNELS, 4) + 4)
+
+/*
+ * 计量模式下每个电网周期的结果: 电压、电流通道的交流有效值
+ * (码值，Q24.8)，有功功率 (码值平方，有符号) 和周期 (ns)
+ * 前 3 个作为电压通道后面的 32 位扫描通道；周期是时长，
+ * IIO 没有对应的通道类型，只在 sysfs 上提供
+ */
+#define IMX6ULL_ADC_METER_CHAN(_type, _ch, _name, _sign, _si) {	\
+	.type = (_type),					\
+	.indexed = 1,						\
+	.channel = (_ch),					\
+	.extend_name = (_name),					\
+	.scan_index = (_si),					\
+	.scan_type = {						\
+		.sign = (_sign),				\
+		.realbits = 32,					\
+		.storagebits = 32,				\
+		.endianness = IIO_CPU,				\
+	},							\
+}
+
+enum {
+	IMX6ULL_ADC_METER_VRMS,
+	IMX6ULL_ADC_METER_IRMS,
+	IMX6ULL_ADC_METER_POWER,
+	IMX6ULL_ADC_METER_PERIOD,
+	IMX6ULL_ADC_METER_NUM,
+	/* 只用作 sysfs 属性的地址: 由周期换算的频率 */
+	IMX6ULL_ADC_METER_FREQ = IMX6ULL_ADC_METER_NUM,
+};
+
+#define IMX6ULL_ADC_METER_CHANS	IMX6ULL_ADC_METER_PERIOD
+
+/* 计量记录: 前面同普通扫描，再加 3 个 32 位结果 */
+#define IMX6ULL_ADC_METER_BYTES	\
+	((IMX6ULL_ADC_SCAN_WORDS + 2 * IMX6ULL_ADC_METER_CHANS) * sizeof(u16))
+
+/*
+ * 交流计量的周期累加状态，in_voltage0 接电压互感器，in_voltage1 接电流互感器
+ *
+ * 样本先减去上一周期的均值 (dc，Q4) 再平方、相乘，得到交流分量；
+ * 电压从负半周 (低于 -hyst) 回到 0 以上算一次上升过零，
+ * 过零时刻在前后两个扫描的时间戳之间线性插值
+ */
+struct imx6ull_adc_meter {
+	s64 dc[2];
+	bool dc_valid;
+	s64 sum[2];
+	u64 sq[2];
+	s64 vi;
+	u32 n;
+	bool armed;
+	bool started;
+	s64 prev_v;
+	s64 prev_ts;
+	s64 cross_ts;
+};
+
+/*
+ * 二阶 CIC 抽取滤波器的每通道状态
+ * 积分器和梳状器都用 u32 回绕运算，12 位输入在 256 倍抽取时
+ * 需要 12 + 2 * 8 = 28 位，不会溢出
+ */
+struct imx6ull_adc_cic {
+	u32 integ[2];
+	u32 comb[2];
+};
+
+/* 默认毛刺门限 (原始码值)，12 位 3.3V 下约 50mV */
+#define IMX6ULL_ADC_GLITCH_DEF_THRESHOLD	64
+/* slew 模式连续超限这么多次后认为是真实阶跃，不再拒绝 */
+#define IMX6ULL_ADC_GLITCH_HOLDOFF		2
+
+/*
+ * 每通道毛刺滤波器状态
+ * median: 3 点滑动中值，偏离中值超过门限的样本计为被拒绝
+ * slew:   与上一个接受的样本相差超过门限时丢弃，输出保持上一个值
+ */
+struct imx6ull_adc_glitch {
+	enum glitch_mode mode;
+	u32 threshold;
+	u32 rejected;
+
+	u16 hist[2];
+	u8 fill;
+	u8 pending;
+};
+
+/*
+ * Goertzel 单频检测器，在下半部对某个通道的输出样本逐个迭代，
+ * 每 len 个样本得到一次 freq 处的幅度
+ *
+ * 采样率不假设，用上一块首尾的时间戳测出来，触发、自由运行和
+ * 抽取都一样处理；刚启动的第一块只测采样率。
+ * phase 是每个样本转过的角度 (2^32 为一周)，0 表示还不能检测；
+ * cos/sin 是 Q30 定点，s1/s2 是谐振器状态
+ *
+ * len 不超过 512、频率在 [fs/len, fs/2 - fs/len] 内时，16 位输入下
+ * |s1|、|s2| <= len * 65535 / sin(2 * pi / len)，约 2.7e9，乘 Q30 系数
+ * 不会溢出 s64；最后的 |X| 不超过 len * 65535
+ */
+struct imx6ull_adc_tone {
+	int chan;
+	u32 freq;
+	u32 len;
+	u32 thresh;
+
+	int pos;
+	u32 phase;
+	s32 cos;
+	s32 sin;
+	s64 s1;
+	s64 s2;
+	u32 n;
+	s64 ts0;
+	u32 amplitude;
+	bool above;
+};
+
+/* 上半部锁存的一个转换结果，pos 是它在扫描序列里的位置 */
+struct imx6ull_adc_raw {
+	s64 ts;
+	u16 value;
+	u8 pos;
+};
+
 struct imx6ull_adc {
 	struct device *dev;
 	void __iomem *regs;
 	struct clk *clk;
+	int irq;
 
 	u32 value;
+	int conv_chan;
+	int num_chans;
 	u32 vref_uv;
 	struct regulator *vref;
-	
+
+	/*
+	 * bandgap 比例模式: bg_chan 上接的是 bg_uv 的已知电压，-1 表示没有；
+	 * ref_uv 是最近一次反推出来的 VREFH，ref_time 是测量时刻
+	 */
+	enum ref_mode ref_mode;
+	int bg_chan;
+	u32 bg_uv;
+	u32 ref_uv;
+	unsigned long ref_time;
+
+	/* 上次成功校准的结果 (CAL 寄存器)，硬件参考在 probe 时就固定了 */
+	u32 cal_data;
+	bool cal_valid;
+
 	/* 不同平均次数对应的采样频率 */
 	u32 sample_freq_avail[5];
+	unsigned long adck_rate;
 
 	struct imx6ull_adc_feature adc_feature;
 	struct completion completion;
 	struct mutex lock;
+
+	/* 当前生效的配置快照，和流式采集时等待扫描边界切换的下一份 */
+	struct imx6ull_adc_config __rcu *cfg;
+	struct imx6ull_adc_config *cfg_next;
+
+	/* 异步校准，完成前读取等待或返回 -EBUSY */
+	struct delayed_work cal_work;
+	struct completion cal_done;
+	int cal_retries;
+	bool ready;
+
+	/* 可修改的通道表，过采样时要更新 realbits */
+	struct iio_chan_spec *channels;
+
+	/* 缓冲模式下的扫描序列 */
+	u8 scan_chans[IMX6ULL_ADC_MAX_CHANNELS];
+	int scan_count;
+	int scan_pos;
+	s64 scan_ts;
+	bool scan_busy;
+	bool triggered;
+	bool continuous;
+
+	/*
+	 * 自适应采样率: 信号变化不超过 adapt_delta 时用 base 档，
+	 * 超过时切到 burst 档，连续 adapt_hold 次扫描安静后再降回去
+	 */
+	u32 adapt_delta;
+	int adapt_base;
+	int adapt_burst;
+	u32 adapt_hold;
+	bool adapt_active;
+	bool adapt_moved;
+	u32 adapt_quiet;
+	/* [0] base 档, [1] burst 档的 CFG/GC */
+	u32 adapt_regs[2][2];
+	u16 adapt_last[IMX6ULL_ADC_MAX_CHANNELS];
+
+	/* 流式采集时实际使用的采样率下标，和下一个输出要带的状态位 */
+	int cur_rate;
+	u16 status;
+
+	/* 还没在数据流里标出的丢失扫描数，和本次缓冲各通道丢失的样本数 */
+	atomic_t gap;
+	atomic_t lost[IMX6ULL_ADC_MAX_CHANNELS];
+
+	/* hrtimer 触发器 */
+	struct iio_trigger *trig;
+	struct hrtimer timer;
+	ktime_t trig_period;
+	u32 trig_freq;
+	u32 missed;
+
+	/* 挂起期间的门限唤醒，-1 表示不使用 */
+	int wake_chan;
+	int wake_rising;
+	int wake_falling;
+	bool wake_armed;
+	int wake_value;
+
+	/* 外部数据就绪引脚 (例如 ICM20608 的 INT) 做成的触发器 */
+	struct iio_trigger *ext_trig;
+	struct gpio_desc *ext_gpio;
+	bool ext_enabled;
+
+	/* 软件过采样 */
+	int osr_idx;
+	u32 cic_count;
+	u32 cic_settle;
+	struct imx6ull_adc_cic cic[IMX6ULL_ADC_MAX_CHANNELS];
+
+	struct imx6ull_adc_glitch glitch[IMX6ULL_ADC_MAX_CHANNELS];
+
+	/* 单频检测器，配置在 info->lock 下修改，运行状态只在下半部用 */
+	struct imx6ull_adc_tone tone[IMX6ULL_ADC_TONES];
+
+	/*
+	 * 交流计量: meter_enable 是用户设置，缓冲打开时电压、电流通道都在
+	 * 扫描里才 meter_active；这时 kfifo 每个周期收到一条记录，不再是每个扫描
+	 * meter_pos 是两个通道在扫描里的位置，meter_res 是最近一个周期的结果
+	 */
+	bool meter_enable;
+	bool meter_active;
+	int meter_pos[2];
+	struct imx6ull_adc_meter meter;
+	u32 meter_res[IMX6ULL_ADC_METER_NUM];
+	u32 meter_cycles;
+	u8 mbuf[IMX6ULL_ADC_METER_BYTES] __aligned(8);
+
+	/*
+	 * 缓冲模式下中断分成两半: 上半部只读 R0、取时间戳、启动扫描里的
+	 * 下一个通道，结果放进 raw；滤波、抽取、推送缓冲都在下半部线程里做
+	 * seq_pos 是硬件正在转换的扫描位置，scan_pos 是下半部处理到的位置
+	 */
+	struct imx6ull_adc_raw raw[IMX6ULL_ADC_RAW_SIZE];
+	u32 raw_head;
+	u32 raw_tail;
+	u32 raw_lost;
+	int seq_pos;
+	int irq_prio;
+
+	/* 流式采集期间的 CPU 延迟上限，见 imx6ull_adc_qos_start() */
+	struct pm_qos_request pm_qos;
+
+	/*
+	 * 字符设备消费者用的内部缓冲，扫描掩码是所有 STREAM 消费者通道的
+	 * 并集，和 sysfs 的 kfifo 一起挂在 IIO 核心上，核心按两者的并集启动采集
+	 */
+	struct iio_buffer engine;
+	unsigned long engine_mask;
+	bool engine_on;
+	struct mutex engine_lock;
+
+	/*
+	 * 通道配置；global_* 是全局设置里对应的位，
+	 * loaded_* 是硬件里现在的值，相同时换通道不用写寄存器
+	 */
+	struct imx6ull_adc_profile profile[IMX6ULL_ADC_MAX_CHANNELS];
+	u32 global_cfg;
+	u32 global_gc;
+	u32 loaded_cfg;
+	u32 loaded_gc;
+
+	u16 buffer[IMX6ULL_ADC_SCAN_WORDS] __aligned(8);
+	/* 按字节存储时送给 IIO 的扫描，布局见 imx6ull_adc_pack8() */
+	u8 pbuf[IMX6ULL_ADC_SCAN_WORDS * sizeof(u16)] __aligned(8);
+
+	/* 二进制读接口 /dev/imx6ull-adcN */
+	struct miscdevice miscdev;
+
+	/* mmap 了环形缓冲的文件，中断按 RCU 遍历，增删在 info->lock 下 */
+	struct list_head rings;
+	wait_queue_head_t ring_wq;
+};
+
+/* 每个打开的文件各自记住自己的通道集合和环形缓冲 */
+struct imx6ull_adc_file {
+	struct imx6ull_adc *info;
+	u32 chan_mask;
+	/* read() 和 IOC_READ 的输出格式，IMX6ULL_ADC_FMT_* */
+	u32 fmt;
+
+	struct list_head node;
+	struct imx6ull_adc_ring_hdr *ring;
+	struct imx6ull_adc_ring_rec *recs;
+	/* 用内核自己记的大小，不信任共享页里的 size */
+	u32 ring_size;
+
+	/*
+	 * 这个消费者的抽取: 每 decim 个扫描平均成一条记录
+	 * lock 保护 streaming、chan_mask、decim 和累加状态，
+	 * 下半部线程分发时和 ioctl 修改时都要拿
+	 */
+	spinlock_t lock;
+	bool streaming;
+	u32 decim;
+	u32 acc[IMX6ULL_ADC_MAX_CHANNELS];
+	u32 acc_n;
+	s64 acc_ts;
+	u16 acc_flags;
+	u32 acc_lost;
 };
 
+/* 基本转换时间 (ADCK 周期)，8/10/12 位分别是 17/21/25 */
+static inline u32 imx6ull_adc_bct(int res_mode)
+{
+	return 2 * res_mode + 1;
+}
+
 static inline void imx6ull_adc_calculate_rates(struct imx6ull_adc *info)
 {
 	unsigned long adck_rate, ipg_rate = clk_get_rate(info->clk);
@@ -145,6 +760,7 @@ static inline void imx6ull_adc_calculate_rates(struct imx6ull_adc *info)
      * 例如: IPG=66MHz, clk_div=8, 则 ADCK=8.25MHz
      */
 	adck_rate = ipg_rate / info->adc_feature.clk_div;
+	info->adck_rate = adck_rate;
 
 	/*
      * 计算每种平均模式下的采样频率
@@ -153,13 +769,14 @@ static inline void imx6ull_adc_calculate_rates(struct imx6ull_adc *info)
 	 * ADC conversion time = SFCAdder + AverageNum x (BCT + LSTAdder)
 	 * SFCAdder: fixed to 6 ADCK cycles
 	 * AverageNum: 1, 4, 8, 16, 32 samples for hardware average.
-	 * BCT (Base Conversion Time): fixed to 25 ADCK cycles for 12 bit mode
+	 * BCT (Base Conversion Time): 17/21/25 ADCK cycles for 8/10/12 bit mode
 	 * LSTAdder(Long Sample Time): fixed to 3 ADCK cycles
 	 * 
      * 基本转换时间: 6个ADCK周期
      * 单次转换时间: 25个ADCK周期 (采样) + 3个ADCK周期 (转换) = 28个周期
+     * 8/10 位模式下 BCT 是 17/21 个周期，同样的设置能采得更快
      * 
-     * 例如:
+     * 12 位时例如:
      * - 无平均(1次):   频率 = ADCK / (6 + 1×28)  = ADCK / 34
      * - 4次平均:       频率 = ADCK / (6 + 4×28)  = ADCK / 118
      * - 8次平均:       频率 = ADCK / (6 + 8×28)  = ADCK / 230
@@ -168,7 +785,8 @@ static inline void imx6ull_adc_calculate_rates(struct imx6ull_adc *info)
      */
 	for (i = 0; i < ARRAY_SIZE(imx6ull_hw_avgs); i++)
 		info->sample_freq_avail[i] =
-			adck_rate / (6 + imx6ull_hw_avgs[i] * (25 + 3));
+			adck_rate / (6 + imx6ull_hw_avgs[i] *
+			(imx6ull_adc_bct(info->adc_feature.res_mode) + 3));
 }
 
 static inline void imx6ull_adc_cfg_init(struct imx6ull_adc *info)
@@ -179,7 +797,8 @@ static inline void imx6ull_adc_cfg_init(struct imx6ull_adc *info)
 	adc_feature->vol_ref = IMX6ULL_ADCIOC_VR_VREF_SET;	
 
 	adc_feature->calibration = true;
-	adc_feature->ovwren = true;
+	/* 来不及读的结果不覆盖，丢失由驱动统计并在数据流里标出 */
+	adc_feature->ovwren = false;
 
 	adc_feature->res_mode = 12;
 	adc_feature->sample_rate = 1;
@@ -237,10 +856,39 @@ static void imx6ull_adc_cfg_post_set(struct imx6ull_adc *info)
 	writel(gc_data, info->regs + IMX6ULL_REG_ADC_GC);
 }
 
-static void imx6ull_adc_sample_set(struct imx6ull_adc *info)
+/* 硬件平均次数对应的 AVGS/AVGEN 位，或到 cfg/gc 上 */
+static int imx6ull_adc_avg_bits(int avg_idx, u32 *cfg, u32 *gc)
+{
+	switch (avg_idx) {
+	case IMX6ULL_ADC_SAMPLE_1:
+		break;
+	case IMX6ULL_ADC_SAMPLE_4:
+		*gc |= IMX6ULL_ADC_AVGEN;
+		break;
+	case IMX6ULL_ADC_SAMPLE_8:
+		*gc |= IMX6ULL_ADC_AVGEN;
+		*cfg |= IMX6ULL_ADC_AVGS_8;
+		break;
+	case IMX6ULL_ADC_SAMPLE_16:
+		*gc |= IMX6ULL_ADC_AVGEN;
+		*cfg |= IMX6ULL_ADC_AVGS_16;
+		break;
+	case IMX6ULL_ADC_SAMPLE_32:
+		*gc |= IMX6ULL_ADC_AVGEN;
+		*cfg |= IMX6ULL_ADC_AVGS_32;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void imx6ull_adc_sample_regs(struct imx6ull_adc *info,
+				u32 *cfg_reg, u32 *gc_reg)
 {
 	struct imx6ull_adc_feature *adc_feature = &(info->adc_feature);
-	int cfg_data, gc_data;
+	u32 cfg_data, gc_data;
 
 	cfg_data = readl(info->regs + IMX6ULL_REG_ADC_CFG);
 	gc_data = readl(info->regs + IMX6ULL_REG_ADC_GC);
@@ -294,55 +942,220 @@ static void imx6ull_adc_sample_set(struct imx6ull_adc *info)
 	/* update hardware average selection */
 	cfg_data &= ~IMX6ULL_ADC_AVGS_MASK;
 	gc_data &= ~IMX6ULL_ADC_AVGEN;
-	switch (adc_feature->sample_rate) {
-	case IMX6ULL_ADC_SAMPLE_1:
-		break;
-	case IMX6ULL_ADC_SAMPLE_4:
-		gc_data |= IMX6ULL_ADC_AVGEN;
-		break;
-	case IMX6ULL_ADC_SAMPLE_8:
-		gc_data |= IMX6ULL_ADC_AVGEN;
-		cfg_data |= IMX6ULL_ADC_AVGS_8;
-		break;
-	case IMX6ULL_ADC_SAMPLE_16:
-		gc_data |= IMX6ULL_ADC_AVGEN;
-		cfg_data |= IMX6ULL_ADC_AVGS_16;
-		break;
-	case IMX6ULL_ADC_SAMPLE_32:
-		gc_data |= IMX6ULL_ADC_AVGEN;
-		cfg_data |= IMX6ULL_ADC_AVGS_32;
-		break;
-	default:
+	if (imx6ull_adc_avg_bits(adc_feature->sample_rate, &cfg_data, &gc_data))
 		dev_err(info->dev,
 			"error hardware sample average select\n");
+
+	*cfg_reg = cfg_data;
+	*gc_reg = gc_data;
+}
+
+/*
+ * 写全局 CFG/GC，同时记下采样时间和平均相关的位，
+ * 之后换通道时在这个基础上套用通道配置
+ */
+static void imx6ull_adc_write_regs(struct imx6ull_adc *info,
+				u32 cfg_reg, u32 gc_reg)
+{
+	writel(cfg_reg, info->regs + IMX6ULL_REG_ADC_CFG);
+	writel(gc_reg, info->regs + IMX6ULL_REG_ADC_GC);
+
+	info->global_cfg = cfg_reg & IMX6ULL_ADC_PROF_CFG_MASK;
+	info->global_gc = gc_reg & IMX6ULL_ADC_PROF_GC_MASK;
+	info->loaded_cfg = info->global_cfg;
+	info->loaded_gc = info->global_gc;
+}
+
+static void imx6ull_adc_sample_set(struct imx6ull_adc *info)
+{
+	u32 cfg_data, gc_data;
+
+	imx6ull_adc_sample_regs(info, &cfg_data, &gc_data);
+	imx6ull_adc_write_regs(info, cfg_data, gc_data);
+}
+
+/* 一次转换的 ADCK 周期数，见 imx6ull_adc_calculate_rates() */
+static u32 imx6ull_adc_conv_cycles(int res_mode, int avg_idx, int sample_idx)
+{
+	return 6 + imx6ull_hw_avgs[avg_idx] *
+		(imx6ull_adc_bct(res_mode) + 3 +
+		imx6ull_sample_cycles[sample_idx] -
+		imx6ull_sample_cycles[0]);
+}
+
+static void imx6ull_adc_profile_regs(struct imx6ull_adc *info, int ch,
+				struct imx6ull_adc_prof_regs *r)
+{
+	struct imx6ull_adc_profile *p = &info->profile[ch];
+
+	memset(r, 0, sizeof(*r));
+
+	r->cfg_mask = IMX6ULL_ADC_ADLSMP_LONG | IMX6ULL_ADC_ADSTS_MASK;
+	r->cfg_bits = IMX6ULL_ADC_ADSTS(p->sample_idx);
+	if (p->sample_idx >= 4)
+		r->cfg_bits |= IMX6ULL_ADC_ADLSMP_LONG;
+
+	if (p->avg_idx >= 0) {
+		r->cfg_mask |= IMX6ULL_ADC_AVGS_MASK;
+		r->gc_mask = IMX6ULL_ADC_AVGEN;
+		imx6ull_adc_avg_bits(p->avg_idx, &r->cfg_bits, &r->gc_bits);
 	}
+}
 
-	writel(cfg_data, info->regs + IMX6ULL_REG_ADC_CFG);
-	writel(gc_data, info->regs + IMX6ULL_REG_ADC_GC);
+/* 按 adc_feature 生成一份新的配置快照 */
+static struct imx6ull_adc_config *imx6ull_adc_build_config(
+				struct imx6ull_adc *info)
+{
+	struct imx6ull_adc_config *cfg;
+	u32 freq, cycles, worst;
+	int ch, avg;
+
+	cfg = kzalloc(sizeof(*cfg), GFP_KERNEL);
+	if (!cfg)
+		return NULL;
+
+	cfg->sample_rate = info->adc_feature.sample_rate;
+	cfg->res_mode = info->adc_feature.res_mode;
+	cfg->osr_idx = info->osr_idx;
+
+	/* 结果是右对齐的无符号数，只需要去掉高位 */
+	cfg->data_mask = (1 << cfg->res_mode) - 1;
+	cfg->osr_ratio = imx6ull_osr_avail[cfg->osr_idx];
+	cfg->cic_shift = 3 * cfg->osr_idx;
+	/* 和 update_realbits() 一致: 8 位以内的结果在 IIO buffer 里按字节存 */
+	cfg->pack8 = cfg->res_mode + cfg->osr_idx <= 8;
+
+	/*
+	 * 单次转换超时 = 2 倍理论转换时间 + 中断延迟余量
+	 * 按全局设置和各通道配置里最慢的一种计算
+	 */
+	freq = info->sample_freq_avail[cfg->sample_rate];
+	cfg->samp_freq = freq;
+
+	worst = imx6ull_adc_conv_cycles(cfg->res_mode, cfg->sample_rate, 0);
+	for (ch = 0; ch < IMX6ULL_ADC_MAX_CHANNELS; ch++) {
+		imx6ull_adc_profile_regs(info, ch, &cfg->prof[ch]);
+
+		avg = info->profile[ch].avg_idx;
+		cycles = imx6ull_adc_conv_cycles(cfg->res_mode,
+					avg < 0 ? cfg->sample_rate : avg,
+					info->profile[ch].sample_idx);
+		worst = max(worst, cycles);
+		if (info->adck_rate)
+			cfg->conv_ns[ch] = div_u64((u64)cycles * NSEC_PER_SEC,
+						info->adck_rate);
+	}
+
+	if (info->adck_rate)
+		cfg->conv_timeout_us = 2 * DIV_ROUND_UP((u64)worst * USEC_PER_SEC,
+					info->adck_rate) +
+					IMX6ULL_ADC_TIMEOUT_MARGIN_US;
+	else
+		cfg->conv_timeout_us = jiffies_to_msecs(IMX6ULL_ADC_TIMEOUT) * 1000;
+
+	imx6ull_adc_sample_regs(info, &cfg->cfg_reg, &cfg->gc_reg);
+
+	return cfg;
+}
+
+static void imx6ull_adc_swap_config(struct imx6ull_adc *info,
+				struct imx6ull_adc_config *cfg)
+{
+	struct imx6ull_adc_config *old;
+
+	old = rcu_dereference_protected(info->cfg, 1);
+	rcu_assign_pointer(info->cfg, cfg);
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
+/*
+ * 扫描边界上切换到等待中的配置，在中断或关闭缓冲时调用
+ * 连续转换模式下硬件已经在做下一次转换，先停下来再改寄存器
+ */
+static void imx6ull_adc_switch_regs(struct imx6ull_adc *info,
+				u32 cfg_reg, u32 gc_reg)
+{
+	if (info->continuous) {
+		writel(IMX6ULL_ADC_CONV_DISABLE,
+			info->regs + IMX6ULL_REG_ADC_HC0);
+		gc_reg |= IMX6ULL_ADC_ADCON;
+	}
+
+	imx6ull_adc_write_regs(info, cfg_reg, gc_reg);
+}
+
+static bool imx6ull_adc_apply_next_config(struct imx6ull_adc *info)
+{
+	struct imx6ull_adc_config *cfg;
+
+	cfg = xchg(&info->cfg_next, NULL);
+	if (!cfg)
+		return false;
+
+	imx6ull_adc_switch_regs(info, cfg->cfg_reg, cfg->gc_reg);
+	if (info->cur_rate != cfg->sample_rate) {
+		info->cur_rate = cfg->sample_rate;
+		info->status |= IMX6ULL_ADC_STATUS_RATE_CHANGE;
+	}
+	imx6ull_adc_swap_config(info, cfg);
+
+	return true;
+}
+
+/*
+ * adc_feature 改完之后调用，调用者持有 info->lock
+ * 空闲时直接写寄存器并发布；流式采集时交给中断在扫描边界切换，
+ * 避免一次转换用到一半新一半旧的配置
+ */
+static int imx6ull_adc_commit_config(struct imx6ull_adc *info)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+	struct imx6ull_adc_config *cfg;
+
+	cfg = imx6ull_adc_build_config(info);
+	if (!cfg)
+		return -ENOMEM;
+
+	if (iio_buffer_enabled(indio_dev) && info->scan_count) {
+		kfree(xchg(&info->cfg_next, cfg));
+		return 0;
+	}
+
+	imx6ull_adc_write_regs(info, cfg->cfg_reg, cfg->gc_reg);
+	imx6ull_adc_swap_config(info, cfg);
+
+	return 0;
 }
 
-static void imx6ull_adc_calibration(struct imx6ull_adc *info)
+static int imx6ull_adc_calibration(struct imx6ull_adc *info)
 {
 	int adc_gc, hc_cfg;
 
-	if (!info->adc_feature.calibration)
-		return;
+	/* clear the failed flag of a previous attempt */
+	writel(IMX6ULL_ADC_CALF, info->regs + IMX6ULL_REG_ADC_GS);
+	reinit_completion(&info->completion);
 
 	/* enable calibration interrupt */
+	info->conv_chan = IMX6ULL_ADC_CONV_DISABLE;
 	hc_cfg = IMX6ULL_ADC_AIEN | IMX6ULL_ADC_CONV_DISABLE;
 	writel(hc_cfg, info->regs + IMX6ULL_REG_ADC_HC0);
 
 	adc_gc = readl(info->regs + IMX6ULL_REG_ADC_GC);
 	writel(adc_gc | IMX6ULL_ADC_CAL, info->regs + IMX6ULL_REG_ADC_GC);
 
-	if (!wait_for_completion_timeout(&info->completion, IMX6ULL_ADC_TIMEOUT))
+	if (!wait_for_completion_timeout(&info->completion, IMX6ULL_ADC_TIMEOUT)) {
 		dev_err(info->dev, "Timeout for adc calibration\n");
+		return -ETIMEDOUT;
+	}
 
 	adc_gc = readl(info->regs + IMX6ULL_REG_ADC_GS);
-	if (adc_gc & IMX6ULL_ADC_CALF)
+	if (adc_gc & IMX6ULL_ADC_CALF) {
 		dev_err(info->dev, "ADC calibration failed\n");
+		return -EIO;
+	}
 
-	info->adc_feature.calibration = false;
+	return 0;
 }
 
 static void imx6ull_adc_cfg_set(struct imx6ull_adc *info)
@@ -361,182 +1174,2836 @@ static void imx6ull_adc_cfg_set(struct imx6ull_adc *info)
 	writel(cfg_data, info->regs + IMX6ULL_REG_ADC_CFG);
 }
 
+/*
+ * 在工作队列里做校准，probe 不再被最长 100ms 的校准阻塞
+ * 失败后按指数退避重试，重试用完后以未校准状态继续工作
+ */
+static void imx6ull_adc_cal_work(struct work_struct *work)
+{
+	struct imx6ull_adc *info = container_of(to_delayed_work(work),
+					struct imx6ull_adc, cal_work);
+	unsigned int delay;
+	int ret;
+
+	mutex_lock(&info->lock);
+
+	ret = imx6ull_adc_calibration(info);
+	if (!ret) {
+		info->cal_data = readl(info->regs + IMX6ULL_REG_ADC_CAL);
+		info->cal_valid = true;
+	}
+	if (ret && info->cal_retries < IMX6ULL_ADC_CAL_RETRIES) {
+		delay = IMX6ULL_ADC_CAL_BACKOFF_MS << info->cal_retries++;
+		dev_warn(info->dev, "retry calibration in %u ms\n", delay);
+		mutex_unlock(&info->lock);
+		schedule_delayed_work(&info->cal_work, msecs_to_jiffies(delay));
+		return;
+	}
+	if (ret)
+		dev_err(info->dev, "giving up calibration, running uncalibrated\n");
+
+	info->adc_feature.calibration = false;
+
+	/* final CFG: low power and disable high speed */
+	imx6ull_adc_cfg_set(info);
+	info->ready = true;
+
+	mutex_unlock(&info->lock);
+	complete_all(&info->cal_done);
+}
+
 static void imx6ull_adc_hw_init(struct imx6ull_adc *info) {
 	/* CFG: Feature set */
 	imx6ull_adc_cfg_post_set(info);
 	imx6ull_adc_sample_set(info);
 
-	/* adc calibration */
-	imx6ull_adc_calibration(info);
+	/*
+	 * 已经校准过就直接写回结果，省掉最长 100ms 的校准；
+	 * resume 时 CAL 寄存器可能已经随电源域丢失，同样写回
+	 */
+	if (info->cal_valid) {
+		writel(info->cal_data, info->regs + IMX6ULL_REG_ADC_CAL);
+		info->adc_feature.calibration = false;
+	}
+
+	/* adc calibration, finished by imx6ull_adc_cal_work() */
+	if (info->adc_feature.calibration) {
+		info->ready = false;
+		info->cal_retries = 0;
+		schedule_delayed_work(&info->cal_work, 0);
+		return;
+	}
 
 	/* final CFG: low power and disable high speed */
 	imx6ull_adc_cfg_set(info);
 }
 
-static int imx6ull_adc_read_data(struct imx6ull_adc *info)
+/* 等校准完成，最多等一次转换超时的时间 */
+static int imx6ull_adc_wait_ready(struct imx6ull_adc *info)
 {
-	int result;
+	long ret;
 
-	result = readl(info->regs + IMX6ULL_REG_ADC_R0);
+	if (info->ready)
+		return 0;
 
-	switch (info->adc_feature.res_mode) {
-		case 8:
-			result &= 0xFF;
-			break;
-		case 10:
-			result &= 0x3FF;
-			break;
-		case 12:
-			result &= 0xFFF;
-			break;
-		default:
-			break;
-	}
+	ret = wait_for_completion_interruptible_timeout(&info->cal_done,
+						IMX6ULL_ADC_TIMEOUT);
+	if (ret < 0)
+		return ret;
 
-	return result;
+	return info->ready ? 0 : -EBUSY;
 }
 
-static irqreturn_t imx6ull_adc_isr(int irq, void *dev_id) {
-	struct imx6ull_adc *info = (struct imx6ull_adc *)dev_id;
-	int coco;
-
-	coco = readl(info->regs + IMX6ULL_REG_ADC_HS);
-	if (coco & IMX6ULL_ADC_HS_COCO0) {
-		info->value = imx6ull_adc_read_data(info);
-		complete(&info->completion);
-	}
-
-	return IRQ_HANDLED;
+static int imx6ull_adc_read_data(struct imx6ull_adc *info,
+				const struct imx6ull_adc_config *cfg)
+{
+	return readl(info->regs + IMX6ULL_REG_ADC_R0) & cfg->data_mask;
 }
 
-static int imx6ull_adc_read_raw(struct iio_dev *indio_dev,
-				struct iio_chan_spec const *chan,
-				int *val,
-				int *val2,
-				long mask)
+static u16 imx6ull_adc_glitch_filter(struct imx6ull_adc_glitch *g, u16 x)
 {
-	struct imx6ull_adc *info = iio_priv(indio_dev);
+	u16 a, b, med;
+
+	switch (g->mode) {
+	case IMX6ULL_ADC_GLITCH_MEDIAN:
+		if (g->fill < 2) {
+			g->hist[g->fill++] = x;
+			return x;
+		}
+
+		a = g->hist[0];
+		b = g->hist[1];
+		med = max(min(a, b), min(max(a, b), x));
+		g->hist[0] = b;
+		g->hist[1] = x;
+
+		if (abs((int)x - (int)med) > g->threshold)
+			g->rejected++;
+
+		return med;
+	case IMX6ULL_ADC_GLITCH_SLEW:
+		if (!g->fill) {
+			g->hist[0] = x;
+			g->fill = 1;
+			return x;
+		}
+
+		if (abs((int)x - (int)g->hist[0]) > g->threshold &&
+			g->pending < IMX6ULL_ADC_GLITCH_HOLDOFF) {
+			g->pending++;
+			g->rejected++;
+			return g->hist[0];
+		}
+
+		g->pending = 0;
+		g->hist[0] = x;
+		return x;
+	default:
+		return x;
+	}
+}
+
+static inline void imx6ull_adc_cic_integrate(struct imx6ull_adc_cic *cic, u32 x)
+{
+	cic->integ[0] += x;
+	cic->integ[1] += cic->integ[0];
+}
+
+static inline u32 imx6ull_adc_cic_comb(struct imx6ull_adc_cic *cic)
+{
+	u32 c0, c1;
+
+	c0 = cic->integ[1] - cic->comb[0];
+	cic->comb[0] = cic->integ[1];
+	c1 = c0 - cic->comb[1];
+	cic->comb[1] = c0;
+
+	return c1;
+}
+
+static void imx6ull_adc_cic_reset(struct imx6ull_adc *info)
+{
+	memset(info->cic, 0, sizeof(info->cic));
+	info->cic_count = 0;
+	/* 前两个输出还在滤波器建立过程中，丢掉 */
+	info->cic_settle = 2;
+}
+
+/* 清掉这个消费者攒了一半的记录，调用者持有 priv->lock */
+static void imx6ull_adc_ring_reset(struct imx6ull_adc_file *priv)
+{
+	memset(priv->acc, 0, sizeof(priv->acc));
+	priv->acc_n = 0;
+	priv->acc_flags = 0;
+	priv->acc_lost = 0;
+}
+
+/*
+ * 把这个扫描里消费者要的通道累加进它的积分器，攒够 decim 个扫描时
+ * 写出一条平均后的记录，返回 true
+ * 状态字里的标志位取这几个扫描的或，丢失数累加，采样率取最后一个
+ */
+static bool imx6ull_adc_ring_demux(struct imx6ull_adc *info,
+				struct imx6ull_adc_file *priv, s64 ts, u16 status,
+				struct imx6ull_adc_ring_rec *rec)
+{
+	int i, n = 0;
+
+	if (!priv->acc_n++)
+		priv->acc_ts = ts;
+	priv->acc_flags |= status & (IMX6ULL_ADC_STATUS_RATE_CHANGE |
+				IMX6ULL_ADC_STATUS_GAP);
+	priv->acc_lost += (status & IMX6ULL_ADC_STATUS_LOST_MASK) >>
+				IMX6ULL_ADC_STATUS_LOST_SHIFT;
+
+	for (i = 0; i < info->scan_count; i++)
+		if (priv->chan_mask & BIT(info->scan_chans[i]))
+			priv->acc[n++] += info->buffer[i];
+
+	if (priv->acc_n < priv->decim)
+		return false;
+
+	rec->timestamp = priv->acc_ts;
+	for (i = 0; i < n; i++) {
+		rec->data[i] = priv->acc[i] / priv->decim;
+		priv->acc[i] = 0;
+	}
+	rec->reserved = 0;
+	rec->status = priv->acc_flags | (status & IMX6ULL_ADC_STATUS_RATE_MASK) |
+		(min_t(u32, priv->acc_lost, 0xff) << IMX6ULL_ADC_STATUS_LOST_SHIFT);
+
+	imx6ull_adc_ring_reset(priv);
+	return true;
+}
+
+/* 写进一个消费者的环，发布了新记录时返回 true，调用者持有 priv->lock */
+static bool imx6ull_adc_ring_put(struct imx6ull_adc *info,
+				struct imx6ull_adc_file *priv, s64 ts, u16 status)
+{
+	struct imx6ull_adc_ring_rec *rec, spare;
+	u32 head, tail;
+
+	head = priv->ring->head;
+	tail = smp_load_acquire(&priv->ring->tail);
+	rec = &priv->recs[head & (priv->ring_size - 1)];
+
+	/* 环满时这条记录还是要攒完，只是不写出去 */
+	if (head - tail >= priv->ring_size) {
+		if (imx6ull_adc_ring_demux(info, priv, ts, status, &spare))
+			priv->ring->dropped++;
+		return false;
+	}
+
+	if (!imx6ull_adc_ring_demux(info, priv, ts, status, rec))
+		return false;
+	smp_store_release(&priv->ring->head, head + 1);
+	return true;
+}
+
+/*
+ * 一个扫描写进每个打开了 STREAM 的 mmap 环形缓冲，在下半部线程里调用，
+ * 已经持有 rcu_read_lock。没打开 STREAM 的文件要的通道不一定在这次扫描里，跳过
+ * 和应用之间只通过 head/tail 同步: 先写记录再 release 发布 head，
+ * acquire 读 tail 保证应用读完之前不会覆盖
+ */
+static void imx6ull_adc_ring_push(struct imx6ull_adc *info, s64 ts,
+				u16 status)
+{
+	struct imx6ull_adc_file *priv;
+	bool wake = false;
+
+	list_for_each_entry_rcu(priv, &info->rings, node) {
+		spin_lock(&priv->lock);
+		if (priv->streaming &&
+			imx6ull_adc_ring_put(info, priv, ts, status))
+			wake = true;
+		spin_unlock(&priv->lock);
+	}
+
+	if (wake)
+		wake_up_interruptible(&info->ring_wq);
+}
+
+/*
+ * 当前扫描序列丢了 n 个扫描，每个通道各丢 n 个样本
+ * hrtimer 回调、触发器的 pollfunc 上半部和下半部线程都会调用，计数用原子操作
+ */
+static void imx6ull_adc_note_gap(struct imx6ull_adc *info, u32 n)
+{
+	int i;
+
+	atomic_add(n, &info->gap);
+	for (i = 0; i < info->scan_count; i++)
+		atomic_add(n, &info->lost[info->scan_chans[i]]);
+}
+
+/*
+ * 连续转换模式下 OVWREN=0，中断来不及读时后面的结果被丢掉，
+ * 硬件没有溢出标志，按两次 COCO 的间隔和单次转换时间估算丢了几个
+ * now 是上半部锁存的时间戳，中断延迟抖动在半个转换周期以内时结果是准确的
+ */
+static void imx6ull_adc_check_overrun(struct imx6ull_adc *info,
+				const struct imx6ull_adc_config *cfg, s64 now)
+{
+	u32 period = cfg->conv_ns[info->scan_chans[0]];
+	u64 convs;
+
+	if (!period || now <= info->scan_ts)
+		return;
+
+	convs = div_u64(now - info->scan_ts + period / 2, period);
+	if (convs > 1)
+		imx6ull_adc_note_gap(info, convs - 1);
+}
+
+/* 在 base 和 burst 两档之间切换，调用者负责重新启动转换 */
+static void imx6ull_adc_adapt_switch(struct imx6ull_adc *info, bool burst)
+{
+	info->cur_rate = burst ? info->adapt_burst : info->adapt_base;
+	info->status |= IMX6ULL_ADC_STATUS_RATE_CHANGE;
+	imx6ull_adc_switch_regs(info, info->adapt_regs[burst][0],
+				info->adapt_regs[burst][1]);
+}
+
+/*
+ * 扫描结束时决定下一轮用哪一档，换档时返回 true
+ * 这一轮有通道变化超过 adapt_delta 就进 burst 档，
+ * burst 档下连续 adapt_hold 轮没有变化再降回 base 档
+ */
+static bool imx6ull_adc_adapt(struct imx6ull_adc *info)
+{
+	bool burst = info->cur_rate == info->adapt_burst;
+	bool moved = info->adapt_moved;
+
+	info->adapt_moved = false;
+
+	if (moved) {
+		info->adapt_quiet = 0;
+		if (burst)
+			return false;
+	} else if (!burst || ++info->adapt_quiet < info->adapt_hold) {
+		return false;
+	}
+
+	info->adapt_quiet = 0;
+	imx6ull_adc_adapt_switch(info, !burst);
+	return true;
+}
+
+/*
+ * 每个样本到达时直接放到缓冲布局里的位置:
+ * 不过采样时写进 info->buffer，过采样时送进该通道的积分器
+ */
+static inline void imx6ull_adc_pack_sample(struct imx6ull_adc *info,
+				const struct imx6ull_adc_config *cfg,
+				int pos, u32 value)
+{
+	if (cfg->osr_ratio == 1)
+		info->buffer[pos] = value;
+	else
+		imx6ull_adc_cic_integrate(&info->cic[pos], value);
+}
+
+/*
+ * 一次扫描结束，有输出时 info->buffer 已经填好，返回 true
+ * 二阶 CIC 增益为 R^2，右移 2*log2(R) - log2(R)/2 位得到多出的有效位
+ */
+static bool imx6ull_adc_decimate_scan(struct imx6ull_adc *info,
+				const struct imx6ull_adc_config *cfg)
+{
+	int i;
+
+	if (cfg->osr_ratio == 1)
+		return true;
+
+	if (++info->cic_count < cfg->osr_ratio)
+		return false;
+	info->cic_count = 0;
+
+	for (i = 0; i < info->scan_count; i++)
+		info->buffer[i] = imx6ull_adc_cic_comb(&info->cic[i]) >>
+					cfg->cic_shift;
+
+	if (info->cic_settle) {
+		info->cic_settle--;
+		return false;
+	}
+
+	return true;
+}
+
+/* 下一个通道的配置和硬件里现在的不同时才改 CFG/GC */
+static void imx6ull_adc_apply_profile(struct imx6ull_adc *info,
+				const struct imx6ull_adc_prof_regs *p)
+{
+	u32 cfg_bits, gc_bits, reg;
+
+	cfg_bits = (info->global_cfg & ~p->cfg_mask) | p->cfg_bits;
+	gc_bits = (info->global_gc & ~p->gc_mask) | p->gc_bits;
+
+	if (cfg_bits != info->loaded_cfg) {
+		reg = readl(info->regs + IMX6ULL_REG_ADC_CFG);
+		reg = (reg & ~IMX6ULL_ADC_PROF_CFG_MASK) | cfg_bits;
+		writel(reg, info->regs + IMX6ULL_REG_ADC_CFG);
+		info->loaded_cfg = cfg_bits;
+	}
+
+	if (gc_bits != info->loaded_gc) {
+		reg = readl(info->regs + IMX6ULL_REG_ADC_GC);
+		reg = (reg & ~IMX6ULL_ADC_PROF_GC_MASK) | gc_bits;
+		writel(reg, info->regs + IMX6ULL_REG_ADC_GC);
+		info->loaded_gc = gc_bits;
+	}
+}
+
+static inline void imx6ull_adc_start_conv(struct imx6ull_adc *info, int channel)
+{
+	if (channel < IMX6ULL_ADC_MAX_CHANNELS) {
+		rcu_read_lock();
+		imx6ull_adc_apply_profile(info,
+				&rcu_dereference(info->cfg)->prof[channel]);
+		rcu_read_unlock();
+	}
+
+	info->conv_chan = channel;
+	writel(IMX6ULL_ADC_AIEN | IMX6ULL_ADC_ADCHC(channel),
+		info->regs + IMX6ULL_REG_ADC_HC0);
+}
+
+static void imx6ull_adc_start_scan(struct imx6ull_adc *info, s64 ts)
+{
+	info->scan_ts = ts;
+	info->scan_busy = true;
+	info->seq_pos = 0;
+	imx6ull_adc_start_conv(info, info->scan_chans[0]);
+}
+
+/*
+ * 按字节存储时的扫描布局，和 IIO 核心按 storagebits 算出来的一致:
+ * 每通道 1 字节，时间戳由 push 函数放到 8 字节对齐处
+ * 3 字节两个样本的 PACK12 在 IIO 里描述不了，只在字符设备上提供，见 imx6ull_adc_fmt_pack()
+ */
+static void *imx6ull_adc_pack8(struct imx6ull_adc *info)
+{
+	u8 *p = info->pbuf;
+	int i;
+
+	for (i = 0; i < info->scan_count; i++)
+		p[i] = info->buffer[i];
+
+	return p;
+}
+
+/*
+ * phase (2^32 为一周) 的 sin/cos，Q30 定点
+ * 先按象限折到 [0, pi/2)，再用泰勒级数算到项为 0
+ */
+static void imx6ull_adc_sincos(u32 phase, s32 *sin, s32 *cos)
+{
+	/* 2 * pi 的 Q30 */
+	const u64 two_pi = 6746518852ULL;
+	s64 x, x2, st, ct, s, c;
+	int k;
+
+	x = ((u64)(phase & (BIT(30) - 1)) * two_pi) >> 32;
+	x2 = (x * x) >> 30;
+
+	s = st = x;
+	c = ct = BIT(30);
+	for (k = 1; st || ct; k++) {
+		st = div_s64(-st * x2 >> 30, (2 * k) * (2 * k + 1));
+		ct = div_s64(-ct * x2 >> 30, (2 * k - 1) * (2 * k));
+		s += st;
+		c += ct;
+	}
+
+	switch (phase >> 30) {
+		case 0:
+			*sin = s;
+			*cos = c;
+			break;
+		case 1:
+			*sin = c;
+			*cos = -s;
+			break;
+		case 2:
+			*sin = -s;
+			*cos = -c;
+			break;
+		default:
+			*sin = -c;
+			*cos = s;
+			break;
+	}
+}
+
+/* 64 位整数平方根 */
+static u32 imx6ull_adc_sqrt64(u64 x)
+{
+	u64 r = 0, b = 1ULL << 62;
+
+	while (b > x)
+		b >>= 2;
+
+	while (b) {
+		if (x >= r + b) {
+			x -= r + b;
+			r = (r >> 1) + b;
+		} else {
+			r >>= 1;
+		}
+		b >>= 2;
+	}
+
+	return r;
+}
+
+/* 按刚结束这一块的时长算下一块用的角度，超出可检测范围时为 0 */
+static void imx6ull_adc_tone_rate(struct imx6ull_adc_tone *t, s64 dt)
+{
+	u64 fs_mhz, phase;
+	u32 lo;
+
+	t->phase = 0;
+	if (dt <= 0)
+		return;
+
+	/* len 个样本之间有 len - 1 个间隔 */
+	fs_mhz = div64_u64((u64)(t->len - 1) * NSEC_PER_SEC * 1000, dt);
+	if (!fs_mhz || fs_mhz > U32_MAX)
+		return;
+
+	phase = div_u64((u64)t->freq * 1000 << 32, fs_mhz);
+
+	lo = div_u64(1ULL << 32, t->len);
+	if (phase < lo || phase > BIT(31) - lo)
+		return;
+
+	t->phase = phase;
+	imx6ull_adc_sincos(t->phase, &t->sin, &t->cos);
+}
+
+/* 一块结束: 幅度 = 2 * |X| / len，越过门限时发事件 */
+static void imx6ull_adc_tone_done(struct imx6ull_adc *info, int idx, s64 ts)
+{
+	struct imx6ull_adc_tone *t = &info->tone[idx];
+	u32 thresh = READ_ONCE(t->thresh);
+	s64 re, im;
+	bool above;
+
+	re = t->s1 - ((t->s2 * t->cos) >> 30);
+	im = (t->s2 * t->sin) >> 30;
+	WRITE_ONCE(t->amplitude,
+		div_u64(2ULL * imx6ull_adc_sqrt64(re * re + im * im), t->len));
+
+	if (!thresh)
+		return;
+
+	above = t->amplitude >= thresh;
+	if (above == t->above)
+		return;
+	t->above = above;
+
+	/* chan2 放检测器编号，同一通道上的几个检测器可以区分开 */
+	iio_push_event(iio_priv_to_dev(info),
+		IIO_EVENT_CODE(IIO_VOLTAGE, 0, IIO_NO_MOD,
+			above ? IIO_EV_DIR_RISING : IIO_EV_DIR_FALLING,
+			IIO_EV_TYPE_MAG, t->chan, 0, idx), ts);
+}
+
+/*
+ * 把一个输出扫描喂给各检测器
+ * 丢了样本或者换了采样率时这一块作废，换采样率还要重新测速
+ */
+static void imx6ull_adc_tone_scan(struct imx6ull_adc *info, s64 ts, u16 status)
+{
+	struct imx6ull_adc_tone *t;
+	s64 s0;
+	int i;
+
+	for (i = 0; i < IMX6ULL_ADC_TONES; i++) {
+		t = &info->tone[i];
+		if (t->pos < 0)
+			continue;
+
+		if (status & (IMX6ULL_ADC_STATUS_GAP |
+				IMX6ULL_ADC_STATUS_RATE_CHANGE)) {
+			if (status & IMX6ULL_ADC_STATUS_RATE_CHANGE)
+				t->phase = 0;
+			t->n = 0;
+			t->s1 = t->s2 = 0;
+		}
+
+		if (!t->n)
+			t->ts0 = ts;
+
+		if (t->phase) {
+			s0 = info->buffer[t->pos] + ((t->s1 * t->cos) >> 29) -
+				t->s2;
+			t->s2 = t->s1;
+			t->s1 = s0;
+		}
+
+		if (++t->n < t->len)
+			continue;
+
+		if (t->phase)
+			imx6ull_adc_tone_done(info, i, ts);
+		imx6ull_adc_tone_rate(t, ts - t->ts0);
+		t->n = 0;
+		t->s1 = t->s2 = 0;
+	}
+}
+
+/* 缓冲打开时按扫描序列找到各检测器的通道位置，没在扫描里的不运行 */
+static void imx6ull_adc_tone_reset(struct imx6ull_adc *info)
+{
+	struct imx6ull_adc_tone *t;
+	int i, j;
+
+	for (i = 0; i < IMX6ULL_ADC_TONES; i++) {
+		t = &info->tone[i];
+		t->pos = -1;
+		for (j = 0; j < info->scan_count; j++)
+			if (info->scan_chans[j] == t->chan)
+				t->pos = j;
+		t->phase = 0;
+		t->n = 0;
+		t->s1 = t->s2 = 0;
+		t->above = false;
+		t->amplitude = 0;
+	}
+}
+
+/*
+ * 按当前的扫描掩码把一个周期的结果排成 IIO 扫描:
+ * 电压、电流通道放这一周期的均值，后面是计量结果，
+ * 每项按自己的存储宽度对齐，和 IIO 核心算出来的布局一致
+ */
+static void imx6ull_adc_meter_push(struct imx6ull_adc *info, s64 ts)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+	const struct iio_chan_spec *chan;
+	unsigned int off = 0, bytes;
+	int bit, k, pos = 0;
+	u32 val;
+
+	for_each_set_bit(bit, indio_dev->active_scan_mask,
+			indio_dev->masklength) {
+		chan = &info->channels[bit];
+		if (chan->type == IIO_TIMESTAMP)
+			break;
+
+		if (bit < info->num_chans) {
+			k = pos++ == info->meter_pos[1];
+			val = info->meter.dc[k] >> 4;
+		} else {
+			val = READ_ONCE(info->meter_res[bit - info->num_chans]);
+		}
+
+		bytes = chan->scan_type.storagebits / 8;
+		off = ALIGN(off, bytes);
+		if (bytes == 1)
+			info->mbuf[off] = val;
+		else if (bytes == 2)
+			*(u16 *)(info->mbuf + off) = val;
+		else
+			*(u32 *)(info->mbuf + off) = val;
+		off += bytes;
+	}
+
+	if (iio_push_to_buffers_with_timestamp(indio_dev, info->mbuf, ts) < 0)
+		imx6ull_adc_note_gap(info, 1);
+}
+
+/* 一个周期结束，cross 是这次过零的时刻 */
+static void imx6ull_adc_meter_done(struct imx6ull_adc *info, s64 cross)
+{
+	struct imx6ull_adc_meter *m = &info->meter;
+	s64 ts = m->cross_ts;
+	int k;
+
+	/* 有效值: Q4 的均方根左移 8 位再开方，得到 Q8 */
+	for (k = 0; k < 2; k++) {
+		WRITE_ONCE(info->meter_res[IMX6ULL_ADC_METER_VRMS + k],
+			imx6ull_adc_sqrt64(div_u64(m->sq[k], m->n) << 8));
+		m->dc[k] = div_s64(m->sum[k], m->n);
+	}
+	m->dc_valid = true;
+
+	/* Q4 * Q4 = Q8，功率只保留整数码值平方 */
+	WRITE_ONCE(info->meter_res[IMX6ULL_ADC_METER_POWER],
+		(u32)(s32)(div_s64(m->vi, m->n) >> 8));
+	WRITE_ONCE(info->meter_res[IMX6ULL_ADC_METER_PERIOD],
+		(u32)(cross - ts));
+	WRITE_ONCE(info->meter_cycles, info->meter_cycles + 1);
+
+	imx6ull_adc_meter_push(info, ts);
+}
+
+/* 把一个输出扫描累加到当前周期，遇到上升过零时结束这一周期 */
+static void imx6ull_adc_meter_scan(struct imx6ull_adc *info,
+				const struct imx6ull_adc_config *cfg,
+				s64 ts, u16 status)
+{
+	struct imx6ull_adc_meter *m = &info->meter;
+	s64 x[2], v[2], hyst, cross;
+	int k;
+
+	for (k = 0; k < 2; k++) {
+		x[k] = (s64)info->buffer[info->meter_pos[k]] << 4;
+		/* 还没有完整周期时用慢速 IIR 跟踪直流 */
+		if (!m->dc_valid)
+			m->dc[k] += (x[k] - m->dc[k]) >> 8;
+		v[k] = x[k] - m->dc[k];
+	}
+
+	/* 丢了样本或者换了采样率，这一周期作废，等下一次过零重新开始 */
+	if (status & (IMX6ULL_ADC_STATUS_GAP |
+			IMX6ULL_ADC_STATUS_RATE_CHANGE)) {
+		m->started = false;
+		m->armed = false;
+	}
+
+	/* 回差取满量程的 1/64 */
+	hyst = BIT(cfg->res_mode + cfg->osr_idx - 2);
+	if (v[0] < -hyst) {
+		m->armed = true;
+	} else if (m->armed && v[0] >= 0) {
+		m->armed = false;
+		cross = ts;
+		if (v[0] > m->prev_v)
+			cross = m->prev_ts + div_s64((ts - m->prev_ts) *
+					-m->prev_v, v[0] - m->prev_v);
+		if (m->started && m->n >= IMX6ULL_ADC_METER_MIN_SCANS)
+			imx6ull_adc_meter_done(info, cross);
+
+		memset(m->sum, 0, sizeof(m->sum));
+		memset(m->sq, 0, sizeof(m->sq));
+		m->vi = 0;
+		m->n = 0;
+		m->started = true;
+		m->cross_ts = cross;
+	}
+	m->prev_v = v[0];
+	m->prev_ts = ts;
+
+	if (!m->started)
+		return;
+
+	for (k = 0; k < 2; k++) {
+		m->sum[k] += x[k];
+		m->sq[k] += v[k] * v[k];
+	}
+	m->vi += v[0] * v[1];
+
+	if (++m->n >= IMX6ULL_ADC_METER_MAX_SCANS)
+		m->started = false;
+}
+
+/*
+ * 缓冲打开时决定这次是否计量，电压、电流通道都在扫描里才计量；
+ * 请求了计量结果通道但不能计量时返回 -EINVAL
+ */
+static int imx6ull_adc_meter_reset(struct imx6ull_adc *info,
+				const unsigned long *mask)
+{
+	const struct imx6ull_adc_config *cfg;
+	bool want = false;
+	int i, k, bits;
+
+	for (i = 0; i < IMX6ULL_ADC_METER_CHANS; i++)
+		want |= test_bit(info->num_chans + i, mask);
+
+	info->meter_pos[0] = info->meter_pos[1] = -1;
+	for (i = 0; i < info->scan_count; i++)
+		if (info->scan_chans[i] < 2)
+			info->meter_pos[info->scan_chans[i]] = i;
+
+	info->meter_active = info->meter_enable &&
+		info->meter_pos[0] >= 0 && info->meter_pos[1] >= 0;
+	if (want && !info->meter_active)
+		return -EINVAL;
+
+	rcu_read_lock();
+	cfg = rcu_dereference(info->cfg);
+	bits = cfg->res_mode + cfg->osr_idx;
+	rcu_read_unlock();
+
+	/* 从中点开始跟踪直流 */
+	memset(&info->meter, 0, sizeof(info->meter));
+	for (k = 0; k < 2; k++)
+		info->meter.dc[k] = (s64)BIT(bits - 1) << 4;
+
+	return 0;
+}
+
+/*
+ * kfifo 里没有状态字，换档和空缺用 IIO 事件标出来，都是 IIO_VOLTAGE、类型 change，
+ * 时间戳和对应扫描的相同:
+ *   换档: 方向 none，chan2 是新档位在 sampling_frequency_available 里的下标
+ *   空缺: 方向 either，chan2 是这个扫描之前丢了几个扫描 (超过 65535 按 65535)
+ */
+static void imx6ull_adc_push_status(struct imx6ull_adc *info, s64 ts,
+				u16 status, u32 gap)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+
+	if (gap)
+		iio_push_event(indio_dev,
+			IIO_EVENT_CODE(IIO_VOLTAGE, 0, IIO_NO_MOD,
+				IIO_EV_DIR_EITHER, IIO_EV_TYPE_CHANGE, 0, 0,
+				min_t(u32, gap, 0xffff)), ts);
+	if (status & IMX6ULL_ADC_STATUS_RATE_CHANGE)
+		iio_push_event(indio_dev,
+			IIO_EVENT_CODE(IIO_VOLTAGE, 0, IIO_NO_MOD,
+				IIO_EV_DIR_NONE, IIO_EV_TYPE_CHANGE, 0, 0,
+				(status & IMX6ULL_ADC_STATUS_RATE_MASK) >>
+				IMX6ULL_ADC_STATUS_RATE_SHIFT), ts);
+}
+
+/*
+ * 下半部处理一个样本，now 是上半部锁存的转换完成时刻
+ * 扫描内的下一个通道已经由上半部启动，这里只处理扫描边界
+ */
+static void imx6ull_adc_scan_sample(struct imx6ull_adc *info,
+				const struct imx6ull_adc_config *cfg, int value,
+				s64 now)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+	bool switched = false;
+	u16 status;
+	u32 gap;
+	s64 ts;
+
+	/* 缓冲正在关闭 */
+	if (!info->scan_count)
+		return;
+
+	if (info->continuous && info->scan_pos == 0)
+		imx6ull_adc_check_overrun(info, cfg, now);
+
+	if (info->adapt_active) {
+		if (abs(value - info->adapt_last[info->scan_pos]) >
+			info->adapt_delta)
+			info->adapt_moved = true;
+		info->adapt_last[info->scan_pos] = value;
+	}
+
+	imx6ull_adc_pack_sample(info, cfg, info->scan_pos, value);
+
+	/* 扫描未完成，下一个通道上半部已经启动了 */
+	if (++info->scan_pos < info->scan_count)
+		return;
+
+	/* 时间戳取这次扫描开始的时刻 */
+	ts = info->scan_ts;
+	info->scan_pos = 0;
+
+	/* 先把这一轮送出去，下一轮的结果要等之后的中断才会写进 buffer */
+	if (imx6ull_adc_decimate_scan(info, cfg)) {
+		status = info->status |
+			(info->cur_rate << IMX6ULL_ADC_STATUS_RATE_SHIFT);
+		gap = atomic_xchg(&info->gap, 0);
+		if (gap)
+			status |= IMX6ULL_ADC_STATUS_GAP |
+				(min_t(u32, gap, 0xff) <<
+				IMX6ULL_ADC_STATUS_LOST_SHIFT);
+		info->status = 0;
+		imx6ull_adc_tone_scan(info, ts, status);
+		imx6ull_adc_ring_push(info, ts, status);
+		imx6ull_adc_push_status(info, ts, status, gap);
+		/*
+		 * 计量模式下 kfifo 只收每个周期的结果；
+		 * kfifo 满了这个扫描也算丢失，在下一个输出上标出
+		 */
+		if (info->meter_active)
+			imx6ull_adc_meter_scan(info, cfg, ts, status);
+		else if (iio_push_to_buffers_with_timestamp(indio_dev,
+				cfg->pack8 ? imx6ull_adc_pack8(info) :
+				(void *)info->buffer, ts) < 0)
+			imx6ull_adc_note_gap(info, 1);
+	}
+
+	/*
+	 * 有新配置或者要换档时先在这个边界上切换，连续模式要重新启动转换
+	 * 连续转换模式下硬件在 COCO 之后已经自动开始了下一次转换，
+	 * 这里只记下它的开始时刻；触发模式下等下一次触发，
+	 * 切换做完才清 scan_busy，触发器不会在切换中途启动扫描；
+	 * 否则马上开始下一轮扫描
+	 */
+	if (unlikely(READ_ONCE(info->cfg_next)))
+		switched = imx6ull_adc_apply_next_config(info);
+	if (info->adapt_active)
+		switched |= imx6ull_adc_adapt(info);
+
+	if (switched && info->continuous) {
+		imx6ull_adc_start_scan(info, iio_get_time_ns());
+	} else if (info->continuous) {
+		info->scan_ts = now;
+	} else if (!info->triggered) {
+		imx6ull_adc_start_scan(info, iio_get_time_ns());
+	} else {
+		WRITE_ONCE(info->scan_busy, false);
+	}
+}
+
+/*
+ * 触发器的 pollfunc，在触发器的硬中断上下文里直接启动一轮扫描
+ * 上一轮还没做完时这次触发作废，计入 missed，并在下一个输出上标出空缺
+ *
+ * 时间戳在进入时就取，和挂在同一个触发器上的其他 IIO 设备
+ * (同样在这次 iio_trigger_poll() 里取 iio_get_time_ns()) 属于同一时钟域，
+ * 对应的是触发时刻而不是转换结束时刻
+ */
+static irqreturn_t imx6ull_adc_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+
+	pf->timestamp = iio_get_time_ns();
+
+	if (info->scan_count) {
+		if (info->scan_busy) {
+			info->missed++;
+			imx6ull_adc_note_gap(info, 1);
+		} else
+			imx6ull_adc_start_scan(info, pf->timestamp);
+	}
+
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
+
+static enum hrtimer_restart imx6ull_adc_hrtimer_func(struct hrtimer *timer)
+{
+	struct imx6ull_adc *info = container_of(timer, struct imx6ull_adc, timer);
+	u64 overruns;
+
+	/* 错过的周期直接跳过，只计数 */
+	overruns = hrtimer_forward_now(timer, info->trig_period);
+	if (overruns > 1) {
+		info->missed += overruns - 1;
+		imx6ull_adc_note_gap(info, overruns - 1);
+	}
+
+	iio_trigger_poll(info->trig);
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * 缓冲模式的上半部: 读结果 (同时清 COCO)，马上启动扫描里的下一个通道，
+ * 把结果和时间戳放进 raw 留给下半部；raw 满了只计数，由下半部标成空缺
+ */
+static void imx6ull_adc_latch(struct imx6ull_adc *info,
+				const struct imx6ull_adc_config *cfg)
+{
+	struct imx6ull_adc_raw *r;
+	s64 now = iio_get_time_ns();
+	u32 head = info->raw_head;
+	u16 value;
+	int pos;
+
+	value = imx6ull_adc_read_data(info, cfg);
+	pos = info->seq_pos;
+	if (++info->seq_pos < info->scan_count)
+		imx6ull_adc_start_conv(info, info->scan_chans[info->seq_pos]);
+	else
+		info->seq_pos = 0;
+
+	if (head - READ_ONCE(info->raw_tail) >= IMX6ULL_ADC_RAW_SIZE) {
+		info->raw_lost++;
+		return;
+	}
+
+	r = &info->raw[head & (IMX6ULL_ADC_RAW_SIZE - 1)];
+	r->ts = now;
+	r->value = value;
+	r->pos = pos;
+	smp_store_release(&info->raw_head, head + 1);
+}
+
+static irqreturn_t imx6ull_adc_isr(int irq, void *dev_id) {
+	struct imx6ull_adc *info = (struct imx6ull_adc *)dev_id;
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+	const struct imx6ull_adc_config *cfg;
+	irqreturn_t ret = IRQ_HANDLED;
+	int coco;
+
+	coco = readl(info->regs + IMX6ULL_REG_ADC_HS);
+	if (!(coco & IMX6ULL_ADC_HS_COCO0))
+		return IRQ_HANDLED;
+
+	rcu_read_lock();
+	cfg = rcu_dereference(info->cfg);
+
+	/* 挂起监视模式下 COCO 只在比较条件成立时置位 */
+	if (info->wake_armed) {
+		writel(IMX6ULL_ADC_CONV_DISABLE, info->regs + IMX6ULL_REG_ADC_HC0);
+		info->wake_value = imx6ull_adc_read_data(info, cfg);
+		pm_wakeup_event(info->dev, 0);
+		goto out;
+	}
+
+	if (iio_buffer_enabled(indio_dev)) {
+		imx6ull_adc_latch(info, cfg);
+		ret = IRQ_WAKE_THREAD;
+		goto out;
+	}
+
+	/* 单次读取在等 completion，直接在这里处理 */
+	info->value = imx6ull_adc_read_data(info, cfg);
+	if (info->conv_chan < IMX6ULL_ADC_MAX_CHANNELS)
+		info->value = imx6ull_adc_glitch_filter(
+			&info->glitch[info->conv_chan], info->value);
+	complete(&info->completion);
+
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/* irq_thread_priority 改过之后，下半部线程下次运行时换成新的优先级 */
+static void imx6ull_adc_thread_prio(struct imx6ull_adc *info)
+{
+	struct sched_param param = {
+		.sched_priority = READ_ONCE(info->irq_prio),
+	};
+
+	if (current->rt_priority != param.sched_priority)
+		sched_setscheduler(current, SCHED_FIFO, &param);
+}
+
+/*
+ * 缓冲模式的下半部，按顺序处理上半部锁存的结果
+ * 上半部来不及放进 raw 的结果按整个扫描计成空缺
+ */
+static irqreturn_t imx6ull_adc_isr_thread(int irq, void *dev_id)
+{
+	struct imx6ull_adc *info = dev_id;
+	const struct imx6ull_adc_config *cfg;
+	struct imx6ull_adc_raw *r;
+	u32 tail, lost;
+	u16 value;
+
+	imx6ull_adc_thread_prio(info);
+
+	lost = xchg(&info->raw_lost, 0);
+	if (lost && info->scan_count)
+		imx6ull_adc_note_gap(info, DIV_ROUND_UP(lost, info->scan_count));
+
+	rcu_read_lock();
+	for (tail = info->raw_tail; tail != smp_load_acquire(&info->raw_head);
+		tail++) {
+		r = &info->raw[tail & (IMX6ULL_ADC_RAW_SIZE - 1)];
+		/* 扫描边界上可能换了配置，每个样本重新取一次 */
+		cfg = rcu_dereference(info->cfg);
+
+		info->scan_pos = r->pos;
+		value = imx6ull_adc_glitch_filter(
+			&info->glitch[info->scan_chans[r->pos]], r->value);
+		imx6ull_adc_scan_sample(info, cfg, value, r->ts);
+		smp_store_release(&info->raw_tail, tail + 1);
+	}
+	rcu_read_unlock();
+
+	return IRQ_HANDLED;
+}
+
+/* 当前配置下一次转换的超时时间 (us)，见 imx6ull_adc_build_config() */
+static u32 imx6ull_adc_conv_timeout_us(struct imx6ull_adc *info)
+{
+	u32 timeout_us;
+
+	rcu_read_lock();
+	timeout_us = rcu_dereference(info->cfg)->conv_timeout_us;
+	rcu_read_unlock();
+
+	return timeout_us;
+}
+
+static int imx6ull_adc_wait_conv(struct imx6ull_adc *info)
+{
+	u32 timeout_us = imx6ull_adc_conv_timeout_us(info);
 	long ret;
-	unsigned int hc_cfg;
 
-	switch(mask) {
-		case IIO_CHAN_INFO_RAW:
-			mutex_lock(&info->lock);
-			reinit_completion(&info->completion);
-
-			/*  Bit 7 AIEN 1 Conversion complete interrupt enabled.
-				Bit 4:0 ADCH 00001 Input channel 1 selected as ADC input channel */
-			hc_cfg = IMX6ULL_ADC_AIEN | IMX6ULL_ADC_ADCHC(chan->channel);
-			writel(hc_cfg, info->regs + IMX6ULL_REG_ADC_HC0);
-
-			ret = wait_for_completion_interruptible_timeout(&info->completion,
-                              IMX6ULL_ADC_TIMEOUT);
-            if (ret == 0) {
-                mutex_unlock(&info->lock);
-                return -ETIMEDOUT;
-            }
-			if (ret < 0) {
-				mutex_unlock(&info->lock);
-				return ret;
-			}
+	/* 几微秒的转换直接忙等，睡眠唤醒的开销比转换本身还大 */
+	if (timeout_us <= IMX6ULL_ADC_SPIN_MAX_US) {
+		while (!completion_done(&info->completion)) {
+			if (!timeout_us--)
+				return -ETIMEDOUT;
+			udelay(1);
+		}
+		return 0;
+	}
+
+	ret = wait_for_completion_interruptible_timeout(&info->completion,
+					usecs_to_jiffies(timeout_us));
+	if (ret == 0)
+		return -ETIMEDOUT;
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+/*
+ * 转换超时 (丢中断或转换卡住) 后的恢复:
+ * 停止转换，清掉残留的 COCO，再按 adc_feature 重写 CFG/GC
+ */
+static void imx6ull_adc_recover(struct imx6ull_adc *info)
+{
+	u32 hs, gs;
+	int i;
+
+	writel(IMX6ULL_ADC_CONV_DISABLE, info->regs + IMX6ULL_REG_ADC_HC0);
+
+	hs = readl(info->regs + IMX6ULL_REG_ADC_HS);
+	gs = readl(info->regs + IMX6ULL_REG_ADC_GS);
+	dev_warn(info->dev, "conversion timeout, HS=0x%x GS=0x%x, resetting\n",
+		hs, gs);
+
+	/* reading R0 clears a pending COCO0 */
+	if (hs & IMX6ULL_ADC_HS_COCO0)
+		readl(info->regs + IMX6ULL_REG_ADC_R0);
+	/* give the aborted conversion a moment to go idle */
+	for (i = 0; (gs & IMX6ULL_ADC_ADACT) && i < IMX6ULL_ADC_SPIN_MAX_US; i++) {
+		udelay(1);
+		gs = readl(info->regs + IMX6ULL_REG_ADC_GS);
+	}
+
+	imx6ull_adc_cfg_post_set(info);
+	imx6ull_adc_sample_set(info);
+	imx6ull_adc_cfg_set(info);
+}
+
+static int imx6ull_adc_convert(struct imx6ull_adc *info, int channel, int *val)
+{
+	int retry, ret;
+
+	for (retry = 0; retry < 2; retry++) {
+		reinit_completion(&info->completion);
+
+		/*  Bit 7 AIEN 1 Conversion complete interrupt enabled.
+			Bit 4:0 ADCH 00001 Input channel 1 selected as ADC input channel */
+		imx6ull_adc_start_conv(info, channel);
+
+		ret = imx6ull_adc_wait_conv(info);
+		if (ret != -ETIMEDOUT)
+			break;
+
+		imx6ull_adc_recover(info);
+	}
+	if (ret)
+		return ret;
+
+	*val = info->value;
+	return 0;
+}
+
+/*
+ * 单次读取时的过采样：连续转换 R 次后做一次矩形平均 (一阶 CIC)，
+ * 输出位数和缓冲模式一致，两条路径共用同一个 scale
+ */
+static int imx6ull_adc_read_oversampled(struct imx6ull_adc *info,
+				int channel, int *val)
+{
+	u32 ratio, sum = 0;
+	int i, ret, sample, osr_idx;
+
+	rcu_read_lock();
+	osr_idx = rcu_dereference(info->cfg)->osr_idx;
+	rcu_read_unlock();
+	ratio = imx6ull_osr_avail[osr_idx];
+
+	for (i = 0; i < ratio; i++) {
+		ret = imx6ull_adc_convert(info, channel, &sample);
+		if (ret)
+			return ret;
+		sum += sample;
+	}
+
+	*val = sum >> osr_idx;
+	return 0;
+}
+
+static inline u32 imx6ull_adc_all_chans(struct imx6ull_adc *info)
+{
+	return (1 << info->num_chans) - 1;
+}
+
+/*
+ * 对 mask 里的通道连续做 count 次扫描，结果依次放进 data
+ * 整个过程只拿一次锁，给批量读取的属性和字符设备用
+ * 输出位数超过 max_bits 时返回 -EINVAL；设备注销后配置快照已经释放，
+ * 所以要在 ->info 检查之后才能看位数
+ */
+static int imx6ull_adc_read_scans(struct imx6ull_adc *info, u32 mask,
+				u32 count, int max_bits, u16 *data)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+	unsigned long chans = mask;
+	int bit, bits, ret, val;
+	u32 n;
+
+	ret = imx6ull_adc_wait_ready(info);
+	if (ret)
+		return ret;
+
+	mutex_lock(&info->lock);
+	/* 设备已经注销，文件还开着 */
+	if (!indio_dev->info) {
+		ret = -ENODEV;
+		goto out;
+	}
+	if (iio_buffer_enabled(indio_dev)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	rcu_read_lock();
+	bits = rcu_dereference(info->cfg)->res_mode +
+		rcu_dereference(info->cfg)->osr_idx;
+	rcu_read_unlock();
+	if (bits > max_bits) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (n = 0; n < count; n++) {
+		for_each_set_bit(bit, &chans, info->num_chans) {
+			ret = imx6ull_adc_read_oversampled(info,
+					info->channels[bit].channel, &val);
+			if (ret)
+				goto out;
+			*data++ = val;
+		}
+	}
+
+out:
+	mutex_unlock(&info->lock);
+	return ret;
+}
+
+/*
+ * 转换已知电压的通道反推 VREFH: code = Vbg * 2^N / Vref
+ * N 和单次读取的输出位数一致，调用者持有 info->lock 且不在缓冲模式
+ */
+static int imx6ull_adc_measure_ref(struct imx6ull_adc *info)
+{
+	int bits, code, ret;
+
+	ret = imx6ull_adc_read_oversampled(info, info->bg_chan, &code);
+	if (ret)
+		return ret;
+	if (!code)
+		return -EIO;
+
+	rcu_read_lock();
+	bits = rcu_dereference(info->cfg)->res_mode +
+		rcu_dereference(info->cfg)->osr_idx;
+	rcu_read_unlock();
+
+	info->ref_uv = div_u64((u64)info->bg_uv << bits, code);
+	info->ref_time = jiffies;
+	return 0;
+}
+
+/*
+ * 当前 scale 用的参考电压 (uV)
+ * bandgap 模式下上次测量超过 IMX6ULL_ADC_REF_REFRESH 就重新测一次，
+ * 缓冲模式下 HC0 被占用，继续用上次的结果
+ */
+static u32 imx6ull_adc_ref_now(struct imx6ull_adc *info)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+	u32 uv;
+
+	if (info->ref_mode != IMX6ULL_ADC_REF_BANDGAP)
+		return info->vref_uv;
+
+	mutex_lock(&info->lock);
+	if (info->ready && !iio_buffer_enabled(indio_dev) &&
+		time_after(jiffies, info->ref_time + IMX6ULL_ADC_REF_REFRESH))
+		imx6ull_adc_measure_ref(info);
+	uv = info->ref_uv;
+	mutex_unlock(&info->lock);
+
+	return uv;
+}
+
+static int imx6ull_adc_read_raw(struct iio_dev *indio_dev,
+				struct iio_chan_spec const *chan,
+				int *val,
+				int *val2,
+				long mask)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	const struct imx6ull_adc_config *cfg;
+	int ret;
+
+	switch(mask) {
+		case IIO_CHAN_INFO_RAW:
+			if (chan->type != IIO_VOLTAGE)
+				return -EINVAL;
+
+			ret = imx6ull_adc_wait_ready(info);
+			if (ret)
+				return ret;
+
+			mutex_lock(&info->lock);
+			/* 缓冲模式下 HC0 由扫描序列占用 */
+			if (iio_buffer_enabled(indio_dev)) {
+				mutex_unlock(&info->lock);
+				return -EBUSY;
+			}
+
+			ret = imx6ull_adc_read_oversampled(info, chan->channel, val);
+			mutex_unlock(&info->lock);
+			if (ret)
+				return ret;
+
+			return IIO_VAL_INT;
+		case IIO_CHAN_INFO_SCALE:
+		*val = imx6ull_adc_ref_now(info) / 1000;
+		rcu_read_lock();
+		cfg = rcu_dereference(info->cfg);
+		*val2 = cfg->res_mode + cfg->osr_idx;
+		rcu_read_unlock();
+		return IIO_VAL_FRACTIONAL_LOG2;
+
+		case IIO_CHAN_INFO_SAMP_FREQ:
+			rcu_read_lock();
+			*val = rcu_dereference(info->cfg)->samp_freq;
+			rcu_read_unlock();
+			*val2 = 0;
+			return IIO_VAL_INT;
+
+		default:
+			break;
+	}
+
+	return -EINVAL;
+}
+
+static int imx6ull_adc_write_raw(struct iio_dev *indio_dev,
+			struct iio_chan_spec const *chan,
+			int val,
+			int val2,
+			long mask)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	int i, ret;
+
+	switch (mask) {
+		case IIO_CHAN_INFO_SAMP_FREQ:
+			for (i = 0;
+				i < ARRAY_SIZE(info->sample_freq_avail);
+				i++)
+				if (val == info->sample_freq_avail[i]) {
+					/* 流式采集时在下一个扫描边界生效 */
+					mutex_lock(&info->lock);
+					info->adc_feature.sample_rate = i;
+					ret = imx6ull_adc_commit_config(info);
+					mutex_unlock(&info->lock);
+					return ret;
+				}
+			break;
+
+		default:
+			break;
+	}
+
+	return -EINVAL;
+}
+
+static void imx6ull_adc_update_realbits(struct iio_dev *indio_dev)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	int bits = info->adc_feature.res_mode + info->osr_idx;
+	int i;
+
+	/*
+	 * 计量结果不跟着分辨率变；8 位以内每个样本只占 1 字节，
+	 * 同样大小的 kfifo 能多存一倍的扫描，标准 IIO 工具照样能解
+	 */
+	for (i = 0; i < info->num_chans; i++) {
+		info->channels[i].scan_type.realbits = bits;
+		info->channels[i].scan_type.storagebits = bits <= 8 ? 8 : 16;
+	}
+}
+
+/* 算好两档的寄存器值，从 burst 档开始，先抓住刚打开时的变化 */
+static void imx6ull_adc_adapt_start(struct imx6ull_adc *info)
+{
+	int rate = info->adc_feature.sample_rate;
+
+	info->adc_feature.sample_rate = info->adapt_base;
+	imx6ull_adc_sample_regs(info, &info->adapt_regs[0][0],
+				&info->adapt_regs[0][1]);
+	info->adc_feature.sample_rate = info->adapt_burst;
+	imx6ull_adc_sample_regs(info, &info->adapt_regs[1][0],
+				&info->adapt_regs[1][1]);
+	info->adc_feature.sample_rate = rate;
+
+	info->adapt_moved = false;
+	info->adapt_quiet = 0;
+	memset(info->adapt_last, 0, sizeof(info->adapt_last));
+	imx6ull_adc_adapt_switch(info, true);
+}
+
+/*
+ * 流式采集时每次转换都有一次中断，CPU 在中断之间进深度 idle 的退出延迟
+ * 会直接加在每次中断上。自由运行时按扫描里最快的一次转换申请 CPU 延迟
+ * 上限，取一半留给中断处理本身；自适应时按 burst 档算。触发模式下两轮
+ * 扫描之间隔一个触发周期，按设备自带 hrtimer 触发器的周期算；外部触发器
+ * 的周期不知道，不申请。上限宽到挡不住任何 idle 状态时也不申请
+ */
+static void imx6ull_adc_qos_start(struct imx6ull_adc *info)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+	const struct imx6ull_adc_config *cfg;
+	struct imx6ull_adc_profile *p;
+	u32 ns = U32_MAX, conv;
+	int i, ch;
+
+	if (info->triggered) {
+		if (indio_dev->trig != info->trig)
+			return;
+		ns = div_u64(NSEC_PER_SEC, info->trig_freq);
+	} else {
+		if (!info->adck_rate)
+			return;
+
+		rcu_read_lock();
+		cfg = rcu_dereference(info->cfg);
+		for (i = 0; i < info->scan_count; i++) {
+			ch = info->scan_chans[i];
+			p = &info->profile[ch];
+			conv = cfg->conv_ns[ch];
+			if (info->adapt_active && p->avg_idx < 0)
+				conv = div_u64((u64)imx6ull_adc_conv_cycles(
+						cfg->res_mode, info->adapt_burst,
+						p->sample_idx) *
+						NSEC_PER_SEC, info->adck_rate);
+			ns = min(ns, conv);
+		}
+		rcu_read_unlock();
+	}
+
+	if (ns / 2 / NSEC_PER_USEC >= IMX6ULL_ADC_QOS_MAX_US)
+		return;
+
+	pm_qos_add_request(&info->pm_qos, PM_QOS_CPU_DMA_LATENCY,
+			ns / 2 / NSEC_PER_USEC);
+}
+
+static void imx6ull_adc_qos_stop(struct imx6ull_adc *info)
+{
+	if (pm_qos_request_active(&info->pm_qos))
+		pm_qos_remove_request(&info->pm_qos);
+}
+
+static int imx6ull_adc_buffer_postenable(struct iio_dev *indio_dev)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	struct imx6ull_adc_file *priv;
+	int bit, i, ret = 0;
+	u32 gc_data;
+
+	mutex_lock(&info->lock);
+
+	if (!info->ready) {
+		mutex_unlock(&info->lock);
+		return -EBUSY;
+	}
+
+	info->scan_count = 0;
+	for_each_set_bit(bit, indio_dev->active_scan_mask,
+			indio_dev->masklength) {
+		if (bit >= info->num_chans)
+			continue;
+		info->scan_chans[info->scan_count++] =
+			info->channels[bit].channel;
+	}
+
+	if (!info->scan_count) {
+		mutex_unlock(&info->lock);
+		return -EINVAL;
+	}
+
+	ret = imx6ull_adc_meter_reset(info, indio_dev->active_scan_mask);
+	if (ret) {
+		mutex_unlock(&info->lock);
+		return ret;
+	}
+
+	info->scan_pos = 0;
+	info->scan_busy = false;
+	info->raw_head = 0;
+	info->raw_tail = 0;
+	info->raw_lost = 0;
+	info->missed = 0;
+	atomic_set(&info->gap, 0);
+	for (i = 0; i < IMX6ULL_ADC_MAX_CHANNELS; i++)
+		atomic_set(&info->lost[i], 0);
+	imx6ull_adc_cic_reset(info);
+	imx6ull_adc_tone_reset(info);
+	list_for_each_entry(priv, &info->rings, node) {
+		spin_lock(&priv->lock);
+		imx6ull_adc_ring_reset(priv);
+		spin_unlock(&priv->lock);
+	}
+
+	info->triggered = indio_dev->currentmode == INDIO_BUFFER_TRIGGERED;
+	info->status = 0;
+	info->cur_rate = info->adc_feature.sample_rate;
+
+	/* 触发模式下采样率由触发器决定，自适应只用在自由运行时 */
+	info->adapt_active = info->adapt_delta && !info->triggered;
+	if (info->adapt_active)
+		imx6ull_adc_adapt_start(info);
+
+	/*
+	 * HC1~HC7 只能由硬件触发 (ADTRG) 启动，软件触发只有 HC0 一组，
+	 * 没法用两组 HC/R 做乒乓。单通道自由运行时改用连续转换 (ADCO)：
+	 * 中断读 R0 的同时硬件已经在做下一次转换，不用等中断往返
+	 */
+	info->continuous = !info->triggered && info->scan_count == 1;
+	if (info->continuous) {
+		gc_data = readl(info->regs + IMX6ULL_REG_ADC_GC);
+		writel(gc_data | IMX6ULL_ADC_ADCON,
+			info->regs + IMX6ULL_REG_ADC_GC);
+	}
+
+	imx6ull_adc_qos_start(info);
+
+	if (info->triggered) {
+		ret = iio_triggered_buffer_postenable(indio_dev);
+		if (ret) {
+			info->scan_count = 0;
+			imx6ull_adc_qos_stop(info);
+		}
+	} else {
+		imx6ull_adc_start_scan(info, iio_get_time_ns());
+	}
+
+	mutex_unlock(&info->lock);
+	return ret;
+}
+
+static int imx6ull_adc_buffer_predisable(struct iio_dev *indio_dev)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	u32 gc_data;
+
+	/* 先停掉触发器，再停转换 */
+	if (info->triggered)
+		iio_triggered_buffer_predisable(indio_dev);
+
+	mutex_lock(&info->lock);
+	info->scan_count = 0;
+	writel(IMX6ULL_ADC_CONV_DISABLE, info->regs + IMX6ULL_REG_ADC_HC0);
+	/* 等正在执行的中断退出，它可能又启动了一次转换 */
+	synchronize_irq(info->irq);
+	writel(IMX6ULL_ADC_CONV_DISABLE, info->regs + IMX6ULL_REG_ADC_HC0);
+	/* 还没等到扫描边界的配置在这里生效 */
+	imx6ull_adc_apply_next_config(info);
+	/* 自适应换过档，恢复 sampling_frequency 设置的平均次数 */
+	if (info->adapt_active) {
+		imx6ull_adc_sample_set(info);
+		info->adapt_active = false;
+	}
+
+	if (info->continuous) {
+		gc_data = readl(info->regs + IMX6ULL_REG_ADC_GC);
+		writel(gc_data & ~IMX6ULL_ADC_ADCON,
+			info->regs + IMX6ULL_REG_ADC_GC);
+		info->continuous = false;
+	}
+	imx6ull_adc_qos_stop(info);
+	mutex_unlock(&info->lock);
+
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops imx6ull_buffer_setup_ops = {
+	.postenable = &imx6ull_adc_buffer_postenable,
+	.predisable = &imx6ull_adc_buffer_predisable,
+};
+
+static int imx6ull_adc_trigger_set_state(struct iio_trigger *trig, bool state)
+{
+	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	u32 rate;
+
+	if (!state) {
+		hrtimer_cancel(&info->timer);
+		return 0;
+	}
+
+	rcu_read_lock();
+	rate = rcu_dereference(info->cfg)->samp_freq;
+	rcu_read_unlock();
+
+	/* 一个触发周期内要能做完整轮扫描 */
+	if ((u64)info->trig_freq * info->scan_count > rate) {
+		dev_err(info->dev, "%u Hz x %d channels exceeds %u Hz\n",
+			info->trig_freq, info->scan_count, rate);
+		return -EINVAL;
+	}
+
+	info->trig_period = ns_to_ktime(div_u64(NSEC_PER_SEC, info->trig_freq));
+	hrtimer_start(&info->timer, info->trig_period, HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static const struct iio_trigger_ops imx6ull_adc_trigger_ops = {
+	.owner = THIS_MODULE,
+	.set_trigger_state = &imx6ull_adc_trigger_set_state,
+	.validate_device = &iio_trigger_validate_own_device,
+};
+
+static irqreturn_t imx6ull_adc_ext_trigger_isr(int irq, void *dev_id)
+{
+	struct imx6ull_adc *info = dev_id;
+
+	if (info->ext_enabled)
+		iio_trigger_poll(info->ext_trig);
+
+	return IRQ_HANDLED;
+}
+
+static int imx6ull_adc_ext_trigger_set_state(struct iio_trigger *trig,
+				bool state)
+{
+	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+
+	info->ext_enabled = state;
+
+	return 0;
+}
+
+/* 不限制使用者，IMU 等其他设备也可以挂在这个触发器上同步采样 */
+static const struct iio_trigger_ops imx6ull_adc_ext_trigger_ops = {
+	.owner = THIS_MODULE,
+	.set_trigger_state = &imx6ull_adc_ext_trigger_set_state,
+};
+
+/*
+ * 可选的外部触发引脚，设备树里写 ext-trigger-gpios，上升沿触发
+ * 用于触发源设备本身没有 IIO 触发器的情况
+ */
+static int imx6ull_adc_ext_trigger_init(struct iio_dev *indio_dev)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	int irq, ret;
+
+	info->ext_gpio = devm_gpiod_get_optional(info->dev, "ext-trigger",
+						GPIOD_IN);
+	if (IS_ERR(info->ext_gpio))
+		return PTR_ERR(info->ext_gpio);
+	if (!info->ext_gpio)
+		return 0;
+
+	irq = gpiod_to_irq(info->ext_gpio);
+	if (irq < 0)
+		return irq;
+
+	info->ext_trig = devm_iio_trigger_alloc(info->dev, "%s-ext",
+					dev_name(info->dev));
+	if (!info->ext_trig)
+		return -ENOMEM;
+
+	info->ext_trig->dev.parent = info->dev;
+	info->ext_trig->ops = &imx6ull_adc_ext_trigger_ops;
+	iio_trigger_set_drvdata(info->ext_trig, indio_dev);
+
+	ret = devm_request_irq(info->dev, irq, imx6ull_adc_ext_trigger_isr,
+				IRQF_TRIGGER_RISING, dev_name(info->dev), info);
+	if (ret < 0) {
+		dev_err(info->dev, "failed requesting ext trigger irq %d\n", irq);
+		return ret;
+	}
+
+	return iio_trigger_register(info->ext_trig);
+}
+
+static int imx6ull_adc_trigger_init(struct iio_dev *indio_dev)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	int ret;
+
+	indio_dev->pollfunc = iio_alloc_pollfunc(&imx6ull_adc_trigger_handler,
+					NULL, 0, indio_dev,
+					"%s_consumer%d", indio_dev->name,
+					indio_dev->id);
+	if (!indio_dev->pollfunc)
+		return -ENOMEM;
+
+	info->trig = devm_iio_trigger_alloc(info->dev, "%s-hrtimer",
+					dev_name(info->dev));
+	if (!info->trig) {
+		ret = -ENOMEM;
+		goto fail_dealloc_pollfunc;
+	}
+
+	info->trig->dev.parent = info->dev;
+	info->trig->ops = &imx6ull_adc_trigger_ops;
+	iio_trigger_set_drvdata(info->trig, indio_dev);
+
+	hrtimer_init(&info->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	info->timer.function = imx6ull_adc_hrtimer_func;
+	info->trig_freq = IMX6ULL_ADC_TRIG_DEF_FREQ;
+
+	ret = iio_trigger_register(info->trig);
+	if (ret)
+		goto fail_dealloc_pollfunc;
+
+	ret = imx6ull_adc_ext_trigger_init(indio_dev);
+	if (ret) {
+		info->ext_trig = NULL;
+		goto fail_trigger_unregister;
+	}
+
+	indio_dev->modes |= INDIO_BUFFER_TRIGGERED;
+
+	return 0;
+
+fail_trigger_unregister:
+	iio_trigger_unregister(info->trig);
+fail_dealloc_pollfunc:
+	iio_dealloc_pollfunc(indio_dev->pollfunc);
+	return ret;
+}
+
+static void imx6ull_adc_trigger_remove(struct iio_dev *indio_dev)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+
+	if (info->ext_trig)
+		iio_trigger_unregister(info->ext_trig);
+	iio_trigger_unregister(info->trig);
+	iio_dealloc_pollfunc(indio_dev->pollfunc);
+}
+
+static int imx6ull_adc_get_glitch_mode(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+
+	return info->glitch[chan->channel].mode;
+}
+
+static int imx6ull_adc_set_glitch_mode(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan,
+				unsigned int mode)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	struct imx6ull_adc_glitch *g = &info->glitch[chan->channel];
+
+	mutex_lock(&info->lock);
+	g->fill = 0;
+	g->pending = 0;
+	g->rejected = 0;
+	g->mode = mode;
+	mutex_unlock(&info->lock);
+
+	return 0;
+}
+
+static int imx6ull_adc_get_ref_mode(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+
+	return info->ref_mode;
+}
+
+/* 切到 bandgap 时马上测一次，测不了就不切换 */
+static int imx6ull_adc_set_ref_mode(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan,
+				unsigned int mode)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	int ret = 0;
+
+	if (mode == IMX6ULL_ADC_REF_VREFH) {
+		info->ref_mode = mode;
+		return 0;
+	}
+
+	if (info->bg_chan < 0)
+		return -ENODEV;
+
+	ret = imx6ull_adc_wait_ready(info);
+	if (ret)
+		return ret;
+
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev))
+		ret = -EBUSY;
+	else
+		ret = imx6ull_adc_measure_ref(info);
+	if (!ret)
+		info->ref_mode = mode;
+	mutex_unlock(&info->lock);
+
+	return ret;
+}
+
+static ssize_t imx6ull_adc_read_ref_uv(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan, char *buf)
+{
+	return sprintf(buf, "%u\n", imx6ull_adc_ref_now(iio_priv(indio_dev)));
+}
+
+static ssize_t imx6ull_adc_read_glitch(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	struct imx6ull_adc_glitch *g = &info->glitch[chan->channel];
+
+	switch (private) {
+	case IMX6ULL_ADC_GLITCH_THRESHOLD:
+		return sprintf(buf, "%u\n", g->threshold);
+	case IMX6ULL_ADC_GLITCH_REJECTED:
+		return sprintf(buf, "%u\n", g->rejected);
+	default:
+		return -EINVAL;
+	}
+}
+
+static ssize_t imx6ull_adc_write_glitch(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan,
+				const char *buf, size_t len)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	unsigned int threshold;
+	int ret;
+
+	if (private != IMX6ULL_ADC_GLITCH_THRESHOLD)
+		return -EINVAL;
+
+	ret = kstrtouint(buf, 10, &threshold);
+	if (ret)
+		return ret;
+
+	info->glitch[chan->channel].threshold = threshold;
+
+	return len;
+}
+
+static ssize_t imx6ull_adc_read_profile(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	struct imx6ull_adc_profile *p = &info->profile[chan->channel];
+	size_t len = 0;
+	int i;
+
+	switch (private) {
+	case IMX6ULL_ADC_PROF_SAMPLE:
+		return sprintf(buf, "%u\n", imx6ull_sample_cycles[p->sample_idx]);
+	case IMX6ULL_ADC_PROF_AVG:
+		/* 0 表示跟随 sampling_frequency */
+		return sprintf(buf, "%u\n",
+			p->avg_idx < 0 ? 0 : imx6ull_hw_avgs[p->avg_idx]);
+	case IMX6ULL_ADC_PROF_SAMPLE_AVAIL:
+		for (i = 0; i < ARRAY_SIZE(imx6ull_sample_cycles); i++)
+			len += sprintf(buf + len, "%u ", imx6ull_sample_cycles[i]);
+		break;
+	case IMX6ULL_ADC_PROF_AVG_AVAIL:
+		len += sprintf(buf, "0 ");
+		for (i = 0; i < ARRAY_SIZE(imx6ull_hw_avgs); i++)
+			len += sprintf(buf + len, "%u ", imx6ull_hw_avgs[i]);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	buf[len - 1] = '\n';
+	return len;
+}
+
+/* 本次缓冲这个通道丢失的样本数，见 imx6ull_adc_note_gap() */
+static ssize_t imx6ull_adc_read_lost(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+
+	return sprintf(buf, "%u\n", atomic_read(&info->lost[chan->channel]));
+}
+
+static int imx6ull_adc_find(const u32 *table, int n, u32 val)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (table[i] == val)
+			return i;
+
+	return -EINVAL;
+}
+
+/*
+ * 通道的采样时间 (ADCK 周期) 和硬件平均次数 (0 跟随 sampling_frequency)
+ * 高阻信号源用长采样，低阻通道保持短采样和全速；流式采集时在扫描边界生效
+ */
+static ssize_t imx6ull_adc_write_profile(struct iio_dev *indio_dev,
+				uintptr_t private,
+				struct iio_chan_spec const *chan,
+				const char *buf, size_t len)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	struct imx6ull_adc_profile *p = &info->profile[chan->channel];
+	unsigned int val;
+	int idx, ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	switch (private) {
+	case IMX6ULL_ADC_PROF_SAMPLE:
+		idx = imx6ull_adc_find(imx6ull_sample_cycles,
+				ARRAY_SIZE(imx6ull_sample_cycles), val);
+		break;
+	case IMX6ULL_ADC_PROF_AVG:
+		if (!val) {
+			idx = -1;
+			break;
+		}
+		idx = imx6ull_adc_find(imx6ull_hw_avgs,
+				ARRAY_SIZE(imx6ull_hw_avgs), val);
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (idx == -EINVAL)
+		return idx;
+
+	mutex_lock(&info->lock);
+	if (private == IMX6ULL_ADC_PROF_SAMPLE)
+		p->sample_idx = idx;
+	else
+		p->avg_idx = idx;
+	ret = imx6ull_adc_commit_config(info);
+	mutex_unlock(&info->lock);
+
+	return ret ? ret : len;
+}
+
+/*
+ * 设备树里的通道配置，按通道号排列:
+ *   fsl,sample-cycles = <2 24>;   采样时间 (ADCK 周期)
+ *   fsl,hw-average = <0 16>;      硬件平均次数，0 跟随 sampling_frequency
+ * 缺省时短采样、跟随全局平均，和以前一样
+ */
+static void imx6ull_adc_of_profiles(struct imx6ull_adc *info,
+				struct device_node *np)
+{
+	struct imx6ull_adc_profile *p;
+	u32 val;
+	int i, idx;
+
+	for (i = 0; i < IMX6ULL_ADC_MAX_CHANNELS; i++) {
+		p = &info->profile[i];
+		p->sample_idx = 0;
+		p->avg_idx = -1;
+
+		if (!of_property_read_u32_index(np, "fsl,sample-cycles", i, &val)) {
+			idx = imx6ull_adc_find(imx6ull_sample_cycles,
+					ARRAY_SIZE(imx6ull_sample_cycles), val);
+			if (idx < 0)
+				dev_warn(info->dev,
+					"channel %d: invalid sample cycles %u\n",
+					i, val);
+			else
+				p->sample_idx = idx;
+		}
+
+		if (!of_property_read_u32_index(np, "fsl,hw-average", i, &val) &&
+			val) {
+			idx = imx6ull_adc_find(imx6ull_hw_avgs,
+					ARRAY_SIZE(imx6ull_hw_avgs), val);
+			if (idx < 0)
+				dev_warn(info->dev,
+					"channel %d: invalid hw average %u\n",
+					i, val);
+			else
+				p->avg_idx = idx;
+		}
+	}
+}
+
+static int imx6ull_adc_reg_access(struct iio_dev *indio_dev,
+			unsigned reg, unsigned writeval,
+			unsigned *readval)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+
+	if ((readval == NULL) ||
+		(!(reg % 4) || (reg > IMX6ULL_REG_ADC_CAL)))
+		return -EINVAL;
+
+	*readval = readl(info->regs + reg);
+
+	return 0;
+}
+
+
+/* 
+ * 显示所有可用的采样频率
+ * 当用户读取 sysfs 文件时调用此函数
+ */
+static ssize_t imx6ull_show_samp_freq_avail(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(info->sample_freq_avail); i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+			"%u ", info->sample_freq_avail[i]);
+
+	/* replace trailing space by newline */
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+static IIO_DEV_ATTR_SAMP_FREQ_AVAIL(imx6ull_show_samp_freq_avail);
+
+static ssize_t imx6ull_show_osr(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%u\n", imx6ull_osr_avail[info->osr_idx]);
+}
+
+/*
+ * 设置软件过采样倍率
+ * 输出位数随倍率变化，所以只能在缓冲关闭时修改
+ */
+static ssize_t imx6ull_store_osr(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	unsigned int ratio;
+	int i, ret;
+
+	ret = kstrtouint(buf, 10, &ratio);
+	if (ret)
+		return ret;
 
-			switch (chan->type) {
-				case IIO_VOLTAGE:
-					*val = info->value;
-					break;
-				default:
-					mutex_unlock(&info->lock);
-					return -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(imx6ull_osr_avail); i++)
+		if (ratio == imx6ull_osr_avail[i])
+			break;
+	if (i == ARRAY_SIZE(imx6ull_osr_avail))
+		return -EINVAL;
+
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev)) {
+		mutex_unlock(&info->lock);
+		return -EBUSY;
+	}
+
+	info->osr_idx = i;
+	imx6ull_adc_update_realbits(indio_dev);
+	ret = imx6ull_adc_commit_config(info);
+	mutex_unlock(&info->lock);
+
+	return ret ? ret : len;
+}
+
+static ssize_t imx6ull_show_resolution(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%d\n", info->adc_feature.res_mode);
+}
+
+/*
+ * 设置硬件转换位数 (8/10/12)
+ * 位数低转换周期短，采样率表要重算；8 位时 buffer 里每个样本只占 1 字节
+ */
+static ssize_t imx6ull_store_resolution(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	unsigned int bits;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &bits);
+	if (ret)
+		return ret;
+
+	if (bits != 8 && bits != 10 && bits != 12)
+		return -EINVAL;
+
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev)) {
+		mutex_unlock(&info->lock);
+		return -EBUSY;
+	}
+
+	info->adc_feature.res_mode = bits;
+	imx6ull_adc_calculate_rates(info);
+	imx6ull_adc_update_realbits(indio_dev);
+	ret = imx6ull_adc_commit_config(info);
+	mutex_unlock(&info->lock);
+
+	return ret ? ret : len;
+}
+
+/* 总线时钟下能用的 ADCK 分频，16 是 ipg/2 再 8 分频 */
+static const u8 imx6ull_clk_divs[] = { 1, 2, 4, 8, 16 };
+
+/* 按 imx6ull_adc_cfg_set() 设置的功耗模式检查 ADCK 上限 */
+static bool imx6ull_adc_clk_div_ok(struct imx6ull_adc *info, u32 div)
+{
+	unsigned long max = info->adc_feature.lpm ?
+		IMX6ULL_ADC_ADCK_MAX_LP : IMX6ULL_ADC_ADCK_MAX_NORMAL;
+
+	return clk_get_rate(info->clk) / div <= max;
+}
+
+static ssize_t imx6ull_show_clk_div(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%d\n", info->adc_feature.clk_div);
+}
+
+static ssize_t imx6ull_show_clk_div_avail(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(imx6ull_clk_divs); i++)
+		if (imx6ull_adc_clk_div_ok(info, imx6ull_clk_divs[i]))
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%u ",
+					imx6ull_clk_divs[i]);
+
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+/*
+ * 设置 ADCK 分频，和分辨率、硬件平均一起决定转换速度和精度
+ * 校准结果和时钟有关，换了分频就作废，在工作队列里重新校准，
+ * 校准完成前读数和打开缓冲会等待或返回 -EBUSY
+ */
+static ssize_t imx6ull_store_clk_div(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	unsigned int div;
+	int i, ret;
+
+	ret = kstrtouint(buf, 10, &div);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ARRAY_SIZE(imx6ull_clk_divs); i++)
+		if (div == imx6ull_clk_divs[i])
+			break;
+	if (i == ARRAY_SIZE(imx6ull_clk_divs) ||
+		!imx6ull_adc_clk_div_ok(info, div))
+		return -EINVAL;
+
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev) || !info->ready) {
+		mutex_unlock(&info->lock);
+		return -EBUSY;
+	}
+	if (div == info->adc_feature.clk_div) {
+		mutex_unlock(&info->lock);
+		return len;
+	}
+
+	info->adc_feature.clk_div = div;
+	imx6ull_adc_calculate_rates(info);
+	ret = imx6ull_adc_commit_config(info);
+	if (!ret) {
+		info->cal_valid = false;
+		info->adc_feature.calibration = true;
+		reinit_completion(&info->cal_done);
+		imx6ull_adc_hw_init(info);
+	}
+	mutex_unlock(&info->lock);
+
+	return ret ? ret : len;
+}
+
+/* 一次扫描读出所有通道，空格分隔，省掉每个通道一次 open/read */
+static ssize_t imx6ull_show_all_raw(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	u16 data[IMX6ULL_ADC_MAX_CHANNELS];
+	size_t len = 0;
+	int i, ret;
+
+	ret = imx6ull_adc_read_scans(info, imx6ull_adc_all_chans(info),
+				1, 16, data);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < info->num_chans; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u ", data[i]);
+
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(in_voltage_all_raw, S_IRUGO,
+			imx6ull_show_all_raw, NULL, 0);
+
+static IIO_DEVICE_ATTR(oversampling_ratio, S_IWUSR | S_IRUGO,
+			imx6ull_show_osr, imx6ull_store_osr, 0);
+static IIO_CONST_ATTR(oversampling_ratio_available, "1 4 16 64 256");
+
+static IIO_DEVICE_ATTR(clock_divider, S_IWUSR | S_IRUGO,
+			imx6ull_show_clk_div, imx6ull_store_clk_div, 0);
+static IIO_DEVICE_ATTR(clock_divider_available, S_IRUGO,
+			imx6ull_show_clk_div_avail, NULL, 0);
+
+static IIO_DEVICE_ATTR(in_voltage_resolution, S_IWUSR | S_IRUGO,
+			imx6ull_show_resolution, imx6ull_store_resolution, 0);
+static IIO_CONST_ATTR(in_voltage_resolution_available, "8 10 12");
+
+/* 某个硬件平均/软件过采样组合的有效位数，单位半位 */
+static u32 imx6ull_adc_plan_enob(struct imx6ull_adc *info, int hw, int osr)
+{
+	u32 enob = min_t(u32, IMX6ULL_ADC_BASE_ENOB_HB,
+			2 * info->adc_feature.res_mode);
+
+	enob += ilog2(imx6ull_hw_avgs[hw]) + ilog2(imx6ull_osr_avail[osr]);
+
+	/* 不能超过输出的数据位数 */
+	return min_t(u32, enob, 2 * (info->adc_feature.res_mode + osr));
+}
+
+static u32 imx6ull_adc_plan_rate(struct imx6ull_adc *info, int hw, int osr)
+{
+	return info->sample_freq_avail[hw] / imx6ull_osr_avail[osr];
+}
+
+/* 当前生效的组合: 硬件平均、软件过采样、输出速率和估算的有效位数 */
+static ssize_t imx6ull_show_precision_plan(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	int hw, osr;
+	u32 enob;
+
+	mutex_lock(&info->lock);
+	hw = info->adc_feature.sample_rate;
+	osr = info->osr_idx;
+	enob = imx6ull_adc_plan_enob(info, hw, osr);
+	mutex_unlock(&info->lock);
+
+	return sprintf(buf, "hw_avg=%u osr=%u rate=%u enob=%u.%u\n",
+			imx6ull_hw_avgs[hw], imx6ull_osr_avail[osr],
+			imx6ull_adc_plan_rate(info, hw, osr),
+			enob / 2, (enob & 1) * 5);
+}
+
+/*
+ * 写 "<输出速率 Hz> <有效位数>"，在所有硬件平均 x 软件过采样的组合里
+ * 找满足两者、输出速率最高的一个，设置 sampling_frequency 和
+ * oversampling_ratio；多通道扫描时速率是所有通道共享的
+ * ADC 时钟分频保持不变: 降低 ADCK 只会变慢，不会减小噪声
+ */
+static ssize_t imx6ull_store_precision_plan(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	unsigned int rate, bits;
+	int hw, osr, best_hw = -1, best_osr = 0, ret;
+	u32 best_rate = 0, r;
+
+	if (sscanf(buf, "%u %u", &rate, &bits) != 2 || !rate)
+		return -EINVAL;
+
+	for (hw = 0; hw < ARRAY_SIZE(imx6ull_hw_avgs); hw++) {
+		for (osr = 0; osr < ARRAY_SIZE(imx6ull_osr_avail); osr++) {
+			r = imx6ull_adc_plan_rate(info, hw, osr);
+			if (r < rate ||
+				imx6ull_adc_plan_enob(info, hw, osr) < 2 * bits)
+				continue;
+			if (r > best_rate) {
+				best_rate = r;
+				best_hw = hw;
+				best_osr = osr;
 			}
+		}
+	}
 
-			mutex_unlock(&info->lock);
-			return IIO_VAL_INT;
-		case IIO_CHAN_INFO_SCALE:
-		*val = info->vref_uv / 1000;
-		*val2 = info->adc_feature.res_mode;
-		return IIO_VAL_FRACTIONAL_LOG2;
+	if (best_hw < 0)
+		return -ERANGE;
 
-		case IIO_CHAN_INFO_SAMP_FREQ:
-			*val = info->sample_freq_avail[info->adc_feature.sample_rate];
-			*val2 = 0;
-			return IIO_VAL_INT;
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev)) {
+		mutex_unlock(&info->lock);
+		return -EBUSY;
+	}
+
+	info->adc_feature.sample_rate = best_hw;
+	info->osr_idx = best_osr;
+	imx6ull_adc_update_realbits(indio_dev);
+	ret = imx6ull_adc_commit_config(info);
+	mutex_unlock(&info->lock);
+
+	return ret ? ret : len;
+}
+
+static IIO_DEVICE_ATTR(precision_plan, S_IWUSR | S_IRUGO,
+			imx6ull_show_precision_plan,
+			imx6ull_store_precision_plan, 0);
+
+static ssize_t imx6ull_show_trigger_freq(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%u\n", info->trig_freq);
+}
+
+/*
+ * hrtimer 触发器的频率 (Hz)，不能超过当前平均设置下的转换速率
+ * 多通道扫描时在使能缓冲时再检查一次
+ */
+static ssize_t imx6ull_store_trigger_freq(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	unsigned int freq;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &freq);
+	if (ret)
+		return ret;
+
+	if (!freq ||
+		freq > info->sample_freq_avail[info->adc_feature.sample_rate])
+		return -EINVAL;
+
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev)) {
+		mutex_unlock(&info->lock);
+		return -EBUSY;
+	}
+	info->trig_freq = freq;
+	mutex_unlock(&info->lock);
+
+	return len;
+}
+
+static ssize_t imx6ull_show_irq_prio(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%d\n", info->irq_prio);
+}
+
+/* 下半部线程的 SCHED_FIFO 优先级，流式采集时也可以改 */
+static ssize_t imx6ull_store_irq_prio(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	unsigned int prio;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &prio);
+	if (ret)
+		return ret;
+
+	if (!prio || prio >= MAX_USER_RT_PRIO)
+		return -EINVAL;
+
+	WRITE_ONCE(info->irq_prio, prio);
+
+	return len;
+}
+
+static ssize_t imx6ull_show_trigger_missed(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%u\n", info->missed);
+}
+
+enum {
+	IMX6ULL_ADC_WAKE_CHAN,
+	IMX6ULL_ADC_WAKE_RISING,
+	IMX6ULL_ADC_WAKE_FALLING,
+};
+
+static ssize_t imx6ull_show_wakeup(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+
+	switch (this_attr->address) {
+	case IMX6ULL_ADC_WAKE_CHAN:
+		return sprintf(buf, "%d\n", info->wake_chan);
+	case IMX6ULL_ADC_WAKE_RISING:
+		return sprintf(buf, "%d\n", info->wake_rising);
+	case IMX6ULL_ADC_WAKE_FALLING:
+		return sprintf(buf, "%d\n", info->wake_falling);
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * 挂起门限唤醒的配置，门限单位是当前分辨率下的原始码值
+ * 写 -1 关闭对应项。两个门限都设时必须 falling <= rising:
+ * 反过来硬件的 ACREN 比较会变成区间内成立，这里直接拒绝，不替用户交换
+ */
+static ssize_t imx6ull_store_wakeup(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	int val, ret;
+
+	ret = kstrtoint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	switch (this_attr->address) {
+	case IMX6ULL_ADC_WAKE_CHAN:
+		if (val < -1 || val >= info->num_chans)
+			return -EINVAL;
+		info->wake_chan = val;
+		break;
+	case IMX6ULL_ADC_WAKE_RISING:
+	case IMX6ULL_ADC_WAKE_FALLING:
+		if (val < -1 || val >= (1 << info->adc_feature.res_mode))
+			return -EINVAL;
+		if (this_attr->address == IMX6ULL_ADC_WAKE_RISING) {
+			if (val >= 0 && val < info->wake_falling)
+				return -EINVAL;
+			info->wake_rising = val;
+		} else {
+			if (val > info->wake_rising && info->wake_rising >= 0)
+				return -EINVAL;
+			info->wake_falling = val;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(wakeup_channel, S_IWUSR | S_IRUGO,
+			imx6ull_show_wakeup, imx6ull_store_wakeup,
+			IMX6ULL_ADC_WAKE_CHAN);
+static IIO_DEVICE_ATTR(wakeup_thresh_rising, S_IWUSR | S_IRUGO,
+			imx6ull_show_wakeup, imx6ull_store_wakeup,
+			IMX6ULL_ADC_WAKE_RISING);
+static IIO_DEVICE_ATTR(wakeup_thresh_falling, S_IWUSR | S_IRUGO,
+			imx6ull_show_wakeup, imx6ull_store_wakeup,
+			IMX6ULL_ADC_WAKE_FALLING);
+
+enum {
+	IMX6ULL_ADC_ADAPT_DELTA,
+	IMX6ULL_ADC_ADAPT_BASE,
+	IMX6ULL_ADC_ADAPT_BURST,
+	IMX6ULL_ADC_ADAPT_HOLD,
+};
+
+static ssize_t imx6ull_show_adaptive(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+
+	switch (this_attr->address) {
+	case IMX6ULL_ADC_ADAPT_DELTA:
+		return sprintf(buf, "%u\n", info->adapt_delta);
+	case IMX6ULL_ADC_ADAPT_BASE:
+		return sprintf(buf, "%u\n",
+			info->sample_freq_avail[info->adapt_base]);
+	case IMX6ULL_ADC_ADAPT_BURST:
+		return sprintf(buf, "%u\n",
+			info->sample_freq_avail[info->adapt_burst]);
+	case IMX6ULL_ADC_ADAPT_HOLD:
+		return sprintf(buf, "%u\n", info->adapt_hold);
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * 自适应采样率的配置，只在缓冲关闭时能改
+ * delta 是相邻两次扫描同一通道的原始码值差，0 关闭自适应
+ * base/burst 必须是 sampling_frequency_available 里的值
+ */
+static ssize_t imx6ull_store_adaptive(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	unsigned int val;
+	int i, ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	switch (this_attr->address) {
+	case IMX6ULL_ADC_ADAPT_DELTA:
+		info->adapt_delta = val;
+		break;
+	case IMX6ULL_ADC_ADAPT_BASE:
+	case IMX6ULL_ADC_ADAPT_BURST:
+		for (i = 0; i < ARRAY_SIZE(info->sample_freq_avail); i++)
+			if (val == info->sample_freq_avail[i])
+				break;
+		if (i == ARRAY_SIZE(info->sample_freq_avail)) {
+			ret = -EINVAL;
+			goto out;
+		}
+		if (this_attr->address == IMX6ULL_ADC_ADAPT_BASE)
+			info->adapt_base = i;
+		else
+			info->adapt_burst = i;
+		break;
+	case IMX6ULL_ADC_ADAPT_HOLD:
+		if (!val) {
+			ret = -EINVAL;
+			goto out;
+		}
+		info->adapt_hold = val;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+out:
+	mutex_unlock(&info->lock);
+	return ret ? ret : len;
+}
+
+static IIO_DEVICE_ATTR(adaptive_delta, S_IWUSR | S_IRUGO,
+			imx6ull_show_adaptive, imx6ull_store_adaptive,
+			IMX6ULL_ADC_ADAPT_DELTA);
+static IIO_DEVICE_ATTR(adaptive_base_frequency, S_IWUSR | S_IRUGO,
+			imx6ull_show_adaptive, imx6ull_store_adaptive,
+			IMX6ULL_ADC_ADAPT_BASE);
+static IIO_DEVICE_ATTR(adaptive_burst_frequency, S_IWUSR | S_IRUGO,
+			imx6ull_show_adaptive, imx6ull_store_adaptive,
+			IMX6ULL_ADC_ADAPT_BURST);
+static IIO_DEVICE_ATTR(adaptive_hold, S_IWUSR | S_IRUGO,
+			imx6ull_show_adaptive, imx6ull_store_adaptive,
+			IMX6ULL_ADC_ADAPT_HOLD);
+
+static IIO_DEVICE_ATTR(trigger_frequency, S_IWUSR | S_IRUGO,
+			imx6ull_show_trigger_freq,
+			imx6ull_store_trigger_freq, 0);
+static IIO_DEVICE_ATTR(trigger_missed, S_IRUGO,
+			imx6ull_show_trigger_missed, NULL, 0);
+static IIO_DEVICE_ATTR(irq_thread_priority, S_IWUSR | S_IRUGO,
+			imx6ull_show_irq_prio, imx6ull_store_irq_prio, 0);
+
+/* 单频检测器属性的 address: 低 4 位是检测器编号，高位是哪一项 */
+enum {
+	IMX6ULL_ADC_TONE_CHAN,
+	IMX6ULL_ADC_TONE_FREQ,
+	IMX6ULL_ADC_TONE_LEN,
+	IMX6ULL_ADC_TONE_THRESH,
+	IMX6ULL_ADC_TONE_AMPL,
+};
+
+#define IMX6ULL_ADC_TONE_ADDR(n, item)	(((item) << 4) | (n))
+
+static ssize_t imx6ull_show_tone(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	struct imx6ull_adc_tone *t = &info->tone[this_attr->address & 0xf];
+
+	switch (this_attr->address >> 4) {
+	case IMX6ULL_ADC_TONE_CHAN:
+		return sprintf(buf, "%d\n", t->chan);
+	case IMX6ULL_ADC_TONE_FREQ:
+		return sprintf(buf, "%u\n", t->freq);
+	case IMX6ULL_ADC_TONE_LEN:
+		return sprintf(buf, "%u\n", t->len);
+	case IMX6ULL_ADC_TONE_THRESH:
+		return sprintf(buf, "%u\n", READ_ONCE(t->thresh));
+	case IMX6ULL_ADC_TONE_AMPL:
+		return sprintf(buf, "%u\n", READ_ONCE(t->amplitude));
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * 通道 (-1 关闭)、频率 (Hz) 和块长度只能在缓冲关闭时修改；
+ * 门限是幅度的原始码值，0 表示不发事件，随时可以改
+ */
+static ssize_t imx6ull_store_tone(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	struct imx6ull_adc_tone *t = &info->tone[this_attr->address & 0xf];
+	int val, ret;
+
+	ret = kstrtoint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if ((this_attr->address >> 4) == IMX6ULL_ADC_TONE_THRESH) {
+		if (val < 0)
+			return -EINVAL;
+		WRITE_ONCE(t->thresh, val);
+		return len;
+	}
+
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev)) {
+		ret = -EBUSY;
+		goto out;
+	}
 
-		default:
-			break;
+	switch (this_attr->address >> 4) {
+	case IMX6ULL_ADC_TONE_CHAN:
+		if (val < -1 || (val >= 0 &&
+			!(imx6ull_adc_all_chans(info) & BIT(val))))
+			ret = -EINVAL;
+		else
+			t->chan = val;
+		break;
+	case IMX6ULL_ADC_TONE_FREQ:
+		if (val <= 0 || val > IMX6ULL_ADC_TONE_MAX_FREQ)
+			ret = -EINVAL;
+		else
+			t->freq = val;
+		break;
+	case IMX6ULL_ADC_TONE_LEN:
+		if (val < IMX6ULL_ADC_TONE_MIN_LEN ||
+			val > IMX6ULL_ADC_TONE_MAX_LEN)
+			ret = -EINVAL;
+		else
+			t->len = val;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
 	}
 
-	return -EINVAL;
+out:
+	mutex_unlock(&info->lock);
+	return ret ? ret : len;
 }
 
-static int imx6ull_adc_write_raw(struct iio_dev *indio_dev,
-			struct iio_chan_spec const *chan,
-			int val,
-			int val2,
-			long mask)
+#define IMX6ULL_ADC_TONE_ATTRS(n)					\
+static IIO_DEVICE_ATTR(tone##n##_channel, S_IWUSR | S_IRUGO,		\
+			imx6ull_show_tone, imx6ull_store_tone,		\
+			IMX6ULL_ADC_TONE_ADDR(n, IMX6ULL_ADC_TONE_CHAN));	\
+static IIO_DEVICE_ATTR(tone##n##_frequency, S_IWUSR | S_IRUGO,	\
+			imx6ull_show_tone, imx6ull_store_tone,		\
+			IMX6ULL_ADC_TONE_ADDR(n, IMX6ULL_ADC_TONE_FREQ));	\
+static IIO_DEVICE_ATTR(tone##n##_length, S_IWUSR | S_IRUGO,		\
+			imx6ull_show_tone, imx6ull_store_tone,		\
+			IMX6ULL_ADC_TONE_ADDR(n, IMX6ULL_ADC_TONE_LEN));	\
+static IIO_DEVICE_ATTR(tone##n##_amplitude, S_IRUGO,			\
+			imx6ull_show_tone, NULL,			\
+			IMX6ULL_ADC_TONE_ADDR(n, IMX6ULL_ADC_TONE_AMPL));	\
+static IIO_DEVICE_ATTR(tone##n##_thresh, S_IWUSR | S_IRUGO,		\
+			imx6ull_show_tone, imx6ull_store_tone,		\
+			IMX6ULL_ADC_TONE_ADDR(n, IMX6ULL_ADC_TONE_THRESH))
+
+IMX6ULL_ADC_TONE_ATTRS(0);
+IMX6ULL_ADC_TONE_ATTRS(1);
+IMX6ULL_ADC_TONE_ATTRS(2);
+IMX6ULL_ADC_TONE_ATTRS(3);
+
+static ssize_t imx6ull_show_meter_enable(struct device *dev,
+				struct device_attribute *attr, char *buf)
 {
-	struct imx6ull_adc *info = iio_priv(indio_dev);
-	int i;
-
-	switch (mask) {
-		case IIO_CHAN_INFO_SAMP_FREQ:
-			for (i = 0;
-				i < ARRAY_SIZE(info->sample_freq_avail);
-				i++)
-				if (val == info->sample_freq_avail[i]) {
-					info->adc_feature.sample_rate = i;
-					imx6ull_adc_sample_set(info);
-					return 0;
-				}
-			break;
-
-		default:
-			break;
-	}
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
 
-	return -EINVAL;
+	return sprintf(buf, "%d\n", info->meter_enable);
 }
 
-static int imx6ull_adc_reg_access(struct iio_dev *indio_dev,
-			unsigned reg, unsigned writeval,
-			unsigned *readval)
+/* 计量要两个通道 (电压、电流)，缓冲打开时不能切换 */
+static ssize_t imx6ull_store_meter_enable(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
 {
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
 	struct imx6ull_adc *info = iio_priv(indio_dev);
+	bool enable;
+	int ret;
 
-	if ((readval == NULL) ||
-		(!(reg % 4) || (reg > IMX6ULL_REG_ADC_CAL)))
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	if (enable && info->num_chans < 2)
 		return -EINVAL;
 
-	*readval = readl(info->regs + reg);
+	mutex_lock(&info->lock);
+	if (iio_buffer_enabled(indio_dev)) {
+		mutex_unlock(&info->lock);
+		return -EBUSY;
+	}
+	info->meter_enable = enable;
+	mutex_unlock(&info->lock);
 
-	return 0;
+	return len;
 }
 
-
-/* 
- * 显示所有可用的采样频率
- * 当用户读取 sysfs 文件时调用此函数
+/*
+ * 最近一个周期的结果: 有效值是码值 (3 位小数)，功率是码值平方，
+ * 周期是 ns，频率是 Hz (3 位小数)，乘上 in_voltage_scale 和互感器变比得到物理量
  */
-static ssize_t imx6ull_show_samp_freq_avail(struct device *dev,
+static ssize_t imx6ull_show_meter(struct device *dev,
 				struct device_attribute *attr, char *buf)
 {
 	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
-	size_t len = 0;
-	int i;
-
-	for (i = 0; i < ARRAY_SIZE(info->sample_freq_avail); i++)
-		len += scnprintf(buf + len, PAGE_SIZE - len,
-			"%u ", info->sample_freq_avail[i]);
+	struct iio_dev_attr *this_attr = to_iio_dev_attr(attr);
+	u32 val, mhz, rem;
+
+	if (this_attr->address == IMX6ULL_ADC_METER_FREQ)
+		val = READ_ONCE(info->meter_res[IMX6ULL_ADC_METER_PERIOD]);
+	else
+		val = READ_ONCE(info->meter_res[this_attr->address]);
+
+	switch (this_attr->address) {
+	case IMX6ULL_ADC_METER_VRMS:
+	case IMX6ULL_ADC_METER_IRMS:
+		return sprintf(buf, "%u.%03u\n", val >> 8,
+				((val & 0xff) * 1000) >> 8);
+	case IMX6ULL_ADC_METER_POWER:
+		return sprintf(buf, "%d\n", (s32)val);
+	case IMX6ULL_ADC_METER_PERIOD:
+		return sprintf(buf, "%u\n", val);
+	case IMX6ULL_ADC_METER_FREQ:
+		mhz = val ? div_u64(1000ULL * NSEC_PER_SEC * 1000, val) : 0;
+		mhz = div_u64_rem(mhz, 1000, &rem);
+		return sprintf(buf, "%u.%03u\n", mhz, rem);
+	default:
+		return -EINVAL;
+	}
+}
 
-	/* replace trailing space by newline */
-	buf[len - 1] = '\n';
+static ssize_t imx6ull_show_meter_cycles(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct imx6ull_adc *info = iio_priv(dev_to_iio_dev(dev));
 
-	return len;
+	return sprintf(buf, "%u\n", READ_ONCE(info->meter_cycles));
 }
 
-static IIO_DEV_ATTR_SAMP_FREQ_AVAIL(imx6ull_show_samp_freq_avail);
+static IIO_DEVICE_ATTR(meter_enable, S_IWUSR | S_IRUGO,
+			imx6ull_show_meter_enable, imx6ull_store_meter_enable, 0);
+static IIO_DEVICE_ATTR(meter_voltage_rms, S_IRUGO,
+			imx6ull_show_meter, NULL, IMX6ULL_ADC_METER_VRMS);
+static IIO_DEVICE_ATTR(meter_current_rms, S_IRUGO,
+			imx6ull_show_meter, NULL, IMX6ULL_ADC_METER_IRMS);
+static IIO_DEVICE_ATTR(meter_power, S_IRUGO,
+			imx6ull_show_meter, NULL, IMX6ULL_ADC_METER_POWER);
+static IIO_DEVICE_ATTR(meter_period, S_IRUGO,
+			imx6ull_show_meter, NULL, IMX6ULL_ADC_METER_PERIOD);
+static IIO_DEVICE_ATTR(meter_frequency, S_IRUGO,
+			imx6ull_show_meter, NULL, IMX6ULL_ADC_METER_FREQ);
+static IIO_DEVICE_ATTR(meter_cycles, S_IRUGO,
+			imx6ull_show_meter_cycles, NULL, 0);
+
+#define IMX6ULL_ADC_TONE_ATTR_LIST(n)				\
+	&iio_dev_attr_tone##n##_channel.dev_attr.attr,		\
+	&iio_dev_attr_tone##n##_frequency.dev_attr.attr,	\
+	&iio_dev_attr_tone##n##_length.dev_attr.attr,		\
+	&iio_dev_attr_tone##n##_amplitude.dev_attr.attr
 
 static struct attribute *imx6ull_attributes[] = {
 	&iio_dev_attr_sampling_frequency_available.dev_attr.attr,
+	&iio_dev_attr_in_voltage_all_raw.dev_attr.attr,
+	&iio_dev_attr_oversampling_ratio.dev_attr.attr,
+	&iio_const_attr_oversampling_ratio_available.dev_attr.attr,
+	&iio_dev_attr_in_voltage_resolution.dev_attr.attr,
+	&iio_const_attr_in_voltage_resolution_available.dev_attr.attr,
+	&iio_dev_attr_clock_divider.dev_attr.attr,
+	&iio_dev_attr_clock_divider_available.dev_attr.attr,
+	&iio_dev_attr_precision_plan.dev_attr.attr,
+	&iio_dev_attr_trigger_frequency.dev_attr.attr,
+	&iio_dev_attr_trigger_missed.dev_attr.attr,
+	&iio_dev_attr_irq_thread_priority.dev_attr.attr,
+	&iio_dev_attr_wakeup_channel.dev_attr.attr,
+	&iio_dev_attr_wakeup_thresh_rising.dev_attr.attr,
+	&iio_dev_attr_wakeup_thresh_falling.dev_attr.attr,
+	&iio_dev_attr_adaptive_delta.dev_attr.attr,
+	&iio_dev_attr_adaptive_base_frequency.dev_attr.attr,
+	&iio_dev_attr_adaptive_burst_frequency.dev_attr.attr,
+	&iio_dev_attr_adaptive_hold.dev_attr.attr,
+	IMX6ULL_ADC_TONE_ATTR_LIST(0),
+	IMX6ULL_ADC_TONE_ATTR_LIST(1),
+	IMX6ULL_ADC_TONE_ATTR_LIST(2),
+	IMX6ULL_ADC_TONE_ATTR_LIST(3),
+	&iio_dev_attr_meter_enable.dev_attr.attr,
+	&iio_dev_attr_meter_voltage_rms.dev_attr.attr,
+	&iio_dev_attr_meter_current_rms.dev_attr.attr,
+	&iio_dev_attr_meter_power.dev_attr.attr,
+	&iio_dev_attr_meter_period.dev_attr.attr,
+	&iio_dev_attr_meter_frequency.dev_attr.attr,
+	&iio_dev_attr_meter_cycles.dev_attr.attr,
 	NULL
 };
 
@@ -544,14 +4011,434 @@ static const struct attribute_group imx6ull_attribute_group = {
 	.attrs = imx6ull_attributes,
 };
 
+/*
+ * 检测器门限放在 events/ 下，和 IIO 的事件门限放在一起；
+ * 有了这一组 IIO 核心才会建立事件接口
+ */
+static struct attribute *imx6ull_event_attributes[] = {
+	&iio_dev_attr_tone0_thresh.dev_attr.attr,
+	&iio_dev_attr_tone1_thresh.dev_attr.attr,
+	&iio_dev_attr_tone2_thresh.dev_attr.attr,
+	&iio_dev_attr_tone3_thresh.dev_attr.attr,
+	NULL
+};
+
+static const struct attribute_group imx6ull_event_attribute_group = {
+	.attrs = imx6ull_event_attributes,
+};
+
 static const struct iio_info imx6ull_adc_iio_info = {
 	.driver_module = THIS_MODULE,
 	.read_raw = &imx6ull_adc_read_raw,
 	.write_raw = &imx6ull_adc_write_raw,
 	.debugfs_reg_access = &imx6ull_adc_reg_access,
 	.attrs = &imx6ull_attribute_group,
+	.event_attrs = &imx6ull_event_attribute_group,
+};
+
+static bool imx6ull_adc_valid_mask(struct imx6ull_adc *info, u32 mask)
+{
+	return mask && !(mask & ~imx6ull_adc_all_chans(info));
+}
+
+/* 格式能放下的输出位数 */
+static int imx6ull_adc_fmt_bits(u32 fmt)
+{
+	switch (fmt) {
+		case IMX6ULL_ADC_FMT_PACK12:
+			return 12;
+		case IMX6ULL_ADC_FMT_U8:
+			return 8;
+		default:
+			return 16;
+	}
+}
+
+/* len 字节按 fmt 格式最多能放的样本数 */
+static size_t imx6ull_adc_fmt_samples(u32 fmt, size_t len)
+{
+	switch (fmt) {
+		case IMX6ULL_ADC_FMT_PACK12:
+			return len * 2 / 3;
+		case IMX6ULL_ADC_FMT_U8:
+			return len;
+		default:
+			return len / sizeof(u16);
+	}
+}
+
+/*
+ * 在原地把 n 个 u16 样本压成 fmt 格式，布局见 imx6ull_adc_ioctl.h
+ * 写的位置不会超过读的位置，不需要另一块缓冲
+ */
+static void imx6ull_adc_fmt_pack(u32 fmt, u16 *data, u32 n)
+{
+	u8 *out = (u8 *)data;
+	u16 a, b;
+	u32 i;
+
+	switch (fmt) {
+		case IMX6ULL_ADC_FMT_PACK12:
+			for (i = 0; i + 1 < n; i += 2, out += 3) {
+				a = data[i];
+				b = data[i + 1];
+				out[0] = a;
+				out[1] = (a >> 8) | (b << 4);
+				out[2] = b >> 4;
+			}
+			if (i < n) {
+				a = data[i];
+				out[0] = a;
+				out[1] = a >> 8;
+			}
+			break;
+		case IMX6ULL_ADC_FMT_U8:
+			for (i = 0; i < n; i++)
+				out[i] = data[i];
+			break;
+		default:
+			break;
+	}
+}
+
+/* 做 count 次扫描，按 fmt 格式拷贝到用户空间，返回字节数 */
+static ssize_t imx6ull_adc_cdev_scans(struct imx6ull_adc *info, u32 mask,
+				u32 count, u32 fmt, void __user *ubuf)
+{
+	u32 n = count * hweight32(mask);
+	size_t bytes = imx6ull_adc_fmt_bytes(fmt, n);
+	u16 *data;
+	int ret;
+
+	data = kmalloc(n * sizeof(u16), GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	ret = imx6ull_adc_read_scans(info, mask, count,
+				imx6ull_adc_fmt_bits(fmt), data);
+	if (!ret) {
+		imx6ull_adc_fmt_pack(fmt, data, n);
+		if (copy_to_user(ubuf, data, bytes))
+			ret = -EFAULT;
+	}
+
+	kfree(data);
+	return ret ? ret : bytes;
+}
+
+/* 内部缓冲只用来让 IIO 核心算并集、启动采集，数据由 ring_push 分发 */
+static int imx6ull_adc_engine_store(struct iio_buffer *buffer, const void *data)
+{
+	return 0;
+}
+
+static void imx6ull_adc_engine_release(struct iio_buffer *buffer)
+{
+}
+
+static const struct iio_buffer_access_funcs imx6ull_adc_engine_access = {
+	.store_to = imx6ull_adc_engine_store,
+	.release = imx6ull_adc_engine_release,
+};
+
+/*
+ * 按 STREAM 消费者通道的并集重新挂内部缓冲
+ * 并集变化时 IIO 核心会先停再按新的并集启动一次采集
+ */
+static int imx6ull_adc_engine_update(struct imx6ull_adc *info)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(info);
+	struct imx6ull_adc_file *priv;
+	unsigned long mask = 0;
+	int ret = 0;
+
+	mutex_lock(&info->engine_lock);
+
+	mutex_lock(&info->lock);
+	list_for_each_entry(priv, &info->rings, node)
+		if (priv->streaming)
+			mask |= priv->chan_mask;
+	mutex_unlock(&info->lock);
+
+	if (mask == info->engine_mask && info->engine_on == !!mask)
+		goto out;
+
+	if (info->engine_on) {
+		ret = iio_update_buffers(indio_dev, NULL, &info->engine);
+		if (ret)
+			goto out;
+		info->engine_on = false;
+	}
+
+	info->engine_mask = mask;
+	if (mask) {
+		ret = iio_update_buffers(indio_dev, &info->engine, NULL);
+		if (!ret)
+			info->engine_on = true;
+	}
+
+out:
+	mutex_unlock(&info->engine_lock);
+	return ret;
+}
+
+/* 打开或关闭一个文件的 STREAM，返回原来的状态；打开时丢掉上次攒了一半的记录 */
+static bool imx6ull_adc_set_streaming(struct imx6ull_adc_file *priv, bool on)
+{
+	bool old;
+
+	spin_lock(&priv->lock);
+	old = priv->streaming;
+	if (on && !old)
+		imx6ull_adc_ring_reset(priv);
+	priv->streaming = on;
+	spin_unlock(&priv->lock);
+
+	return old;
+}
+
+static int imx6ull_adc_cdev_open(struct inode *inode, struct file *file)
+{
+	struct imx6ull_adc *info = container_of(file->private_data,
+					struct imx6ull_adc, miscdev);
+	struct imx6ull_adc_file *priv;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	priv->info = info;
+	spin_lock_init(&priv->lock);
+	priv->chan_mask = imx6ull_adc_all_chans(info);
+	priv->decim = 1;
+	/* 文件关闭前 info 不能被释放 */
+	iio_device_get(iio_priv_to_dev(info));
+	file->private_data = priv;
+
+	return nonseekable_open(inode, file);
+}
+
+static int imx6ull_adc_cdev_release(struct inode *inode, struct file *file)
+{
+	struct imx6ull_adc_file *priv = file->private_data;
+	struct imx6ull_adc *info = priv->info;
+
+	if (imx6ull_adc_set_streaming(priv, false))
+		imx6ull_adc_engine_update(info);
+
+	/* munmap 之后才会走到这里，等中断不再访问这个环再释放 */
+	if (priv->ring) {
+		mutex_lock(&info->lock);
+		list_del_rcu(&priv->node);
+		mutex_unlock(&info->lock);
+		synchronize_rcu();
+		vfree(priv->ring);
+	}
+
+	iio_device_put(iio_priv_to_dev(info));
+	kfree(priv);
+
+	return 0;
+}
+
+static ssize_t imx6ull_adc_cdev_read(struct file *file, char __user *buf,
+				size_t len, loff_t *ppos)
+{
+	struct imx6ull_adc_file *priv = file->private_data;
+	size_t count;
+
+	count = imx6ull_adc_fmt_samples(priv->fmt, len) /
+		hweight32(priv->chan_mask);
+	if (!count)
+		return -EINVAL;
+
+	return imx6ull_adc_cdev_scans(priv->info, priv->chan_mask,
+			min_t(size_t, count, IMX6ULL_ADC_READ_MAX_SCANS),
+			priv->fmt, buf);
+}
+
+static long imx6ull_adc_cdev_ioctl(struct file *file, unsigned int cmd,
+				unsigned long arg)
+{
+	struct imx6ull_adc_file *priv = file->private_data;
+	struct imx6ull_adc *info = priv->info;
+	void __user *argp = (void __user *)arg;
+	struct imx6ull_adc_read_req req;
+	u32 mask, val;
+	ssize_t ret;
+
+	switch (cmd) {
+		case IMX6ULL_ADC_IOC_SET_CHANS:
+			if (get_user(mask, (u32 __user *)argp))
+				return -EFAULT;
+			if (!imx6ull_adc_valid_mask(info, mask))
+				return -EINVAL;
+			/* 采集中改通道要先停下来，并集跟着变 */
+			ret = 0;
+			spin_lock(&priv->lock);
+			if (priv->streaming) {
+				ret = -EBUSY;
+			} else {
+				priv->chan_mask = mask;
+				imx6ull_adc_ring_reset(priv);
+			}
+			spin_unlock(&priv->lock);
+			return ret;
+
+		case IMX6ULL_ADC_IOC_SET_DECIM:
+			if (get_user(val, (u32 __user *)argp))
+				return -EFAULT;
+			if (!val || val > IMX6ULL_ADC_MAX_DECIM)
+				return -EINVAL;
+			ret = 0;
+			spin_lock(&priv->lock);
+			if (priv->streaming) {
+				ret = -EBUSY;
+			} else {
+				priv->decim = val;
+				imx6ull_adc_ring_reset(priv);
+			}
+			spin_unlock(&priv->lock);
+			return ret;
+
+		case IMX6ULL_ADC_IOC_STREAM:
+			if (get_user(val, (u32 __user *)argp))
+				return -EFAULT;
+			if (!priv->ring)
+				return -EINVAL;
+			if (imx6ull_adc_set_streaming(priv, !!val) == !!val)
+				return 0;
+			ret = imx6ull_adc_engine_update(info);
+			if (ret)
+				imx6ull_adc_set_streaming(priv, !val);
+			return ret;
+
+		case IMX6ULL_ADC_IOC_GET_CHANS:
+			return put_user(priv->chan_mask, (u32 __user *)argp);
+
+		case IMX6ULL_ADC_IOC_SET_FORMAT:
+			if (get_user(val, (u32 __user *)argp))
+				return -EFAULT;
+			if (val > IMX6ULL_ADC_FMT_U8)
+				return -EINVAL;
+			priv->fmt = val;
+			return 0;
+
+		case IMX6ULL_ADC_IOC_READ:
+			if (copy_from_user(&req, argp, sizeof(req)))
+				return -EFAULT;
+			mask = req.chan_mask ? req.chan_mask : priv->chan_mask;
+			if (!imx6ull_adc_valid_mask(info, mask) || !req.count ||
+				req.count > IMX6ULL_ADC_READ_MAX_SCANS)
+				return -EINVAL;
+			ret = imx6ull_adc_cdev_scans(info, mask, req.count,
+					priv->fmt, (void __user *)(uintptr_t)req.data);
+			return ret < 0 ? ret : 0;
+
+		default:
+			break;
+	}
+
+	return -ENOTTY;
+}
+
+/*
+ * 映射长度 = 一页头 + 记录区，记录条数向下取 2 的幂
+ * 每个文件只能有一个环，缓冲模式打开时由中断填充
+ */
+static int imx6ull_adc_cdev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct imx6ull_adc_file *priv = file->private_data;
+	struct imx6ull_adc *info = priv->info;
+	unsigned long len = vma->vm_end - vma->vm_start;
+	struct imx6ull_adc_ring_hdr *hdr;
+	u32 size;
+	int ret;
+
+	if (vma->vm_pgoff || len <= PAGE_SIZE)
+		return -EINVAL;
+
+	size = (len - PAGE_SIZE) / sizeof(struct imx6ull_adc_ring_rec);
+	if (!size)
+		return -EINVAL;
+	size = rounddown_pow_of_two(size);
+
+	mutex_lock(&info->lock);
+	if (priv->ring) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	hdr = vmalloc_user(len);
+	if (!hdr) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = remap_vmalloc_range(vma, hdr, 0);
+	if (ret) {
+		vfree(hdr);
+		goto out;
+	}
+
+	hdr->size = size;
+	hdr->rec_bytes = sizeof(struct imx6ull_adc_ring_rec);
+	priv->ring = hdr;
+	priv->recs = (void *)hdr + PAGE_SIZE;
+	priv->ring_size = size;
+	list_add_tail_rcu(&priv->node, &info->rings);
+
+out:
+	mutex_unlock(&info->lock);
+	return ret;
+}
+
+/* 没有环时 read() 随时可读；有环时等中断写入新记录 */
+static unsigned int imx6ull_adc_cdev_poll(struct file *file, poll_table *wait)
+{
+	struct imx6ull_adc_file *priv = file->private_data;
+	struct imx6ull_adc_ring_hdr *hdr = priv->ring;
+
+	if (!hdr)
+		return POLLIN | POLLRDNORM;
+
+	poll_wait(file, &priv->info->ring_wq, wait);
+	if (READ_ONCE(hdr->head) != READ_ONCE(hdr->tail))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+static const struct file_operations imx6ull_adc_fops = {
+	.owner = THIS_MODULE,
+	.open = imx6ull_adc_cdev_open,
+	.release = imx6ull_adc_cdev_release,
+	.read = imx6ull_adc_cdev_read,
+	.unlocked_ioctl = imx6ull_adc_cdev_ioctl,
+	.mmap = imx6ull_adc_cdev_mmap,
+	.poll = imx6ull_adc_cdev_poll,
+	.llseek = no_llseek,
 };
 
+static int imx6ull_adc_cdev_register(struct iio_dev *indio_dev)
+{
+	struct imx6ull_adc *info = iio_priv(indio_dev);
+
+	BUILD_BUG_ON(sizeof(((struct imx6ull_adc_ring_rec *)0)->data) <
+			IMX6ULL_ADC_MAX_CHANNELS * sizeof(u16));
+	BUILD_BUG_ON(sizeof(struct imx6ull_adc_ring_rec) != 16);
+
+	info->miscdev.minor = MISC_DYNAMIC_MINOR;
+	info->miscdev.name = devm_kasprintf(info->dev, GFP_KERNEL,
+				IMX6ULL_ADC_NAME "%d", indio_dev->id);
+	if (!info->miscdev.name)
+		return -ENOMEM;
+	info->miscdev.fops = &imx6ull_adc_fops;
+	info->miscdev.parent = info->dev;
+
+	return misc_register(&info->miscdev);
+}
+
 static const struct of_device_id imx6ull_adc_match[] = {
     { .compatible = "fsl,imx6ull-adc", },
     { /* sentinel */ }
@@ -566,7 +4453,10 @@ static int imx6ull_adc_probe(struct platform_device *pdev)
 	struct resource *mem;
 	int irq;
 
-	u32 channels;
+	struct iio_buffer *buffer;
+	struct imx6ull_adc_config *cfg;
+	u32 channels, bg_chan;
+	int i;
 
 	indio_dev = devm_iio_device_alloc(&pdev->dev, sizeof(struct imx6ull_adc));
 	if (!indio_dev){
@@ -588,13 +4478,8 @@ static int imx6ull_adc_probe(struct platform_device *pdev)
 		return irq;
 	}
 
-	ret = devm_request_irq(info->dev, irq,
-				imx6ull_adc_isr, 0,
-				dev_name(&pdev->dev), info);
-	if (ret < 0) {
-		dev_err(&pdev->dev, "failed requesting irq, irq = %d\n", irq);
-		return ret;
-	}
+	info->irq = irq;
+	info->irq_prio = IMX6ULL_ADC_IRQ_PRIO_DEF;
 
 	info->clk = devm_clk_get(&pdev->dev, "adc");
 	if (IS_ERR(info->clk)) {
@@ -613,33 +4498,126 @@ static int imx6ull_adc_probe(struct platform_device *pdev)
 
 	info->vref_uv = regulator_get_voltage(info->vref);
 
+	for (i = 0; i < IMX6ULL_ADC_MAX_CHANNELS; i++)
+		info->glitch[i].threshold = IMX6ULL_ADC_GLITCH_DEF_THRESHOLD;
+	imx6ull_adc_of_profiles(info, pdev->dev.of_node);
+
+	/* 可选: 接了已知电压的通道，用于 bandgap 比例模式 */
+	info->bg_chan = -1;
+	if (!of_property_read_u32(pdev->dev.of_node, "fsl,bandgap-channel",
+				&bg_chan) &&
+		!of_property_read_u32(pdev->dev.of_node, "fsl,bandgap-microvolt",
+				&info->bg_uv) &&
+		bg_chan < IMX6ULL_ADC_CONV_DISABLE && info->bg_uv)
+		info->bg_chan = bg_chan;
+
 	mutex_init(&info->lock);
+
+	info->wake_chan = -1;
+	info->wake_rising = -1;
+	info->wake_falling = -1;
+	device_init_wakeup(&pdev->dev, true);
+
+	for (i = 0; i < IMX6ULL_ADC_TONES; i++) {
+		info->tone[i].chan = -1;
+		info->tone[i].pos = -1;
+		info->tone[i].len = IMX6ULL_ADC_TONE_DEF_LEN;
+	}
+
+	/* 自适应默认关闭 (adapt_delta = 0)，两档取最慢和最快 */
+	info->adapt_base = ARRAY_SIZE(info->sample_freq_avail) - 1;
+	info->adapt_burst = 0;
+	info->adapt_hold = IMX6ULL_ADC_ADAPT_DEF_HOLD;
 	
 	init_completion(&info->completion);
+	init_completion(&info->cal_done);
+	INIT_DELAYED_WORK(&info->cal_work, imx6ull_adc_cal_work);
+	INIT_LIST_HEAD(&info->rings);
+	init_waitqueue_head(&info->ring_wq);
+
+	mutex_init(&info->engine_lock);
+	iio_buffer_init(&info->engine);
+	info->engine.scan_mask = &info->engine_mask;
+	info->engine.access = &imx6ull_adc_engine_access;
 
 	platform_set_drvdata(pdev, indio_dev);
 
 	ret  = of_property_read_u32(pdev->dev.of_node,
 					"num-channels", &channels);
-	if (ret)
-		channels = ARRAY_SIZE(imx6ull_adc_iio_channels);
+	if (ret || channels > IMX6ULL_ADC_MAX_CHANNELS)
+		channels = IMX6ULL_ADC_MAX_CHANNELS;
+
+	/* 电压通道后面追加计量结果和时间戳通道 */
+	info->channels = devm_kcalloc(&pdev->dev,
+				channels + IMX6ULL_ADC_METER_CHANS + 1,
+				sizeof(*info->channels), GFP_KERNEL);
+	if (!info->channels) {
+		ret = -ENOMEM;
+		goto fail_adc_clk_enable;
+	}
+	memcpy(info->channels, imx6ull_adc_iio_channels,
+		channels * sizeof(*info->channels));
+	info->channels[channels] = (struct iio_chan_spec)
+		IMX6ULL_ADC_METER_CHAN(IIO_VOLTAGE, 0, "rms", 'u', channels);
+	info->channels[channels + 1] = (struct iio_chan_spec)
+		IMX6ULL_ADC_METER_CHAN(IIO_VOLTAGE, 1, "rms", 'u', channels + 1);
+	info->channels[channels + 2] = (struct iio_chan_spec)
+		IMX6ULL_ADC_METER_CHAN(IIO_POWER, 0, "real", 's', channels + 2);
+	info->channels[channels + 3] = (struct iio_chan_spec)
+		IIO_CHAN_SOFT_TIMESTAMP(channels + 3);
 
 	indio_dev->name = dev_name(&pdev->dev);
 	indio_dev->dev.parent = &pdev->dev;
 	indio_dev->dev.of_node = pdev->dev.of_node;
 	indio_dev->info = &imx6ull_adc_iio_info;
-	indio_dev->modes = INDIO_DIRECT_MODE;
-	indio_dev->channels = imx6ull_adc_iio_channels;
-	indio_dev->num_channels = (int)channels;
+	indio_dev->modes = INDIO_DIRECT_MODE | INDIO_BUFFER_SOFTWARE;
+	indio_dev->setup_ops = &imx6ull_buffer_setup_ops;
+	indio_dev->channels = info->channels;
+	indio_dev->num_channels = (int)channels + IMX6ULL_ADC_METER_CHANS + 1;
+	info->num_chans = channels;
+
+	buffer = iio_kfifo_allocate();
+	if (!buffer) {
+		ret = -ENOMEM;
+		goto fail_adc_clk_enable;
+	}
+	iio_device_attach_buffer(indio_dev, buffer);
+
+	ret = imx6ull_adc_trigger_init(indio_dev);
+	if (ret) {
+		dev_err(&pdev->dev, "Couldn't initialise the trigger.\n");
+		goto fail_kfifo_free;
+	}
 
 	ret = clk_prepare_enable(info->clk);
 	if (ret) {
 		dev_err(&pdev->dev,
 			"Could not prepare or enable the clock.\n");
-		goto fail_adc_clk_enable;
+		goto fail_trigger_remove;
 	}
 
 	imx6ull_adc_cfg_init(info);
+
+	/*
+	 * 校准期间中断就会读快照，所以先发布一份初始配置
+	 * 之后的修改都经过 imx6ull_adc_commit_config()
+	 */
+	cfg = imx6ull_adc_build_config(info);
+	if (!cfg) {
+		ret = -ENOMEM;
+		goto fail_config;
+	}
+	RCU_INIT_POINTER(info->cfg, cfg);
+
+	/* 中断处理要用上面的快照和 completion，等它们都准备好再申请 */
+	ret = devm_request_threaded_irq(info->dev, irq,
+				imx6ull_adc_isr, imx6ull_adc_isr_thread, 0,
+				dev_name(&pdev->dev), info);
+	if (ret < 0) {
+		dev_err(&pdev->dev, "failed requesting irq, irq = %d\n", irq);
+		goto fail_irq;
+	}
+
 	imx6ull_adc_hw_init(info);
 
 	ret = iio_device_register(indio_dev);
@@ -648,12 +4626,31 @@ static int imx6ull_adc_probe(struct platform_device *pdev)
 		goto fail_iio_device_register;
 	}
 
+	ret = imx6ull_adc_cdev_register(indio_dev);
+	if (ret) {
+		dev_err(&pdev->dev, "Couldn't register the char device.\n");
+		goto fail_cdev_register;
+	}
+
     printk(KERN_INFO "IMX6ULL ADC Driver Probed\n");
     return 0;
 
+fail_cdev_register:
+	iio_device_unregister(indio_dev);
 fail_iio_device_register:
+	cancel_delayed_work_sync(&info->cal_work);
+	/* 校准可能还在转换，先放掉中断再释放快照 */
+	devm_free_irq(info->dev, irq, info);
+fail_irq:
+	kfree(rcu_dereference_protected(info->cfg, 1));
+fail_config:
 	clk_disable_unprepare(info->clk);
+fail_trigger_remove:
+	imx6ull_adc_trigger_remove(indio_dev);
+fail_kfifo_free:
+	iio_kfifo_free(buffer);
 fail_adc_clk_enable:
+	device_init_wakeup(&pdev->dev, false);
 	regulator_disable(info->vref);
 	return ret;
 }
@@ -662,22 +4659,105 @@ static int imx6ull_adc_remove(struct platform_device *pdev)
 {
 	struct iio_dev *indio_dev = platform_get_drvdata(pdev);
 	struct imx6ull_adc *info = iio_priv(indio_dev);
+	struct imx6ull_adc_config *cfg;
 
+	misc_deregister(&info->miscdev);
 	iio_device_unregister(indio_dev);
+	cancel_delayed_work_sync(&info->cal_work);
+	imx6ull_adc_trigger_remove(indio_dev);
+	iio_kfifo_free(indio_dev->buffer);
 	clk_disable_unprepare(info->clk);
 	regulator_disable(info->vref);
+	device_init_wakeup(&pdev->dev, false);
+
+	/*
+	 * 缓冲已经关闭，不会再有中断读快照；还开着的字符设备文件
+	 * 在 info->lock 下先看 ->info，拿锁清掉指针后它们只会返回 -ENODEV
+	 */
+	mutex_lock(&info->lock);
+	cfg = rcu_dereference_protected(info->cfg,
+					lockdep_is_held(&info->lock));
+	RCU_INIT_POINTER(info->cfg, NULL);
+	mutex_unlock(&info->lock);
+	synchronize_rcu();
+	kfree(info->cfg_next);
+	kfree(cfg);
 
     printk(KERN_INFO "IMX6ULL ADC Driver Removed\n");
     return 0;
 }
 
 #ifdef CONFIG_PM_SLEEP
+/*
+ * 挂起期间用 ADACK 异步时钟做低功耗连续转换，并打开硬件比较:
+ * 只有越过门限时才置 COCO 产生中断，这个中断作为唤醒源
+ *
+ *   只设 rising:   ACFGT=1            结果 >= CV1 时成立
+ *   只设 falling:  ACFGT=0            结果 <  CV1 时成立
+ *   两个都设:      ACREN=1, ACFGT=0   结果 < CV1 或 > CV2 时成立
+ */
+static int imx6ull_adc_arm_wakeup(struct imx6ull_adc *info)
+{
+	int cfg_data, gc_data, cv = 0;
+
+	if (info->wake_chan < 0 ||
+		(info->wake_rising < 0 && info->wake_falling < 0))
+		return -EINVAL;
+
+	/* 缓冲还在用 HC0/CFG/GC，不能改成监视模式，按普通挂起处理 */
+	if (iio_buffer_enabled(iio_priv_to_dev(info))) {
+		dev_warn(info->dev, "buffer enabled, threshold wakeup not armed\n");
+		return -EBUSY;
+	}
+
+	writel(IMX6ULL_ADC_CONV_DISABLE, info->regs + IMX6ULL_REG_ADC_HC0);
+
+	cfg_data = readl(info->regs + IMX6ULL_REG_ADC_CFG);
+	cfg_data &= ~(IMX6ULL_ADC_ADCCLK_MASK | IMX6ULL_ADC_CLK_MASK |
+			IMX6ULL_ADC_AVGS_MASK | IMX6ULL_ADC_ADHSC_EN);
+	cfg_data |= IMX6ULL_ADC_ADACK_SEL | IMX6ULL_ADC_ADLPC_EN |
+			IMX6ULL_ADC_ADLSMP_LONG;
+
+	gc_data = IMX6ULL_ADC_ADACKEN | IMX6ULL_ADC_ADCON | IMX6ULL_ADC_ACFE;
+	if (info->wake_rising >= 0 && info->wake_falling >= 0) {
+		gc_data |= IMX6ULL_ADC_ACREN;
+		cv = IMX6ULL_ADC_CV1(info->wake_falling) |
+			IMX6ULL_ADC_CV2(info->wake_rising);
+	} else if (info->wake_rising >= 0) {
+		gc_data |= IMX6ULL_ADC_ACFGT;
+		cv = IMX6ULL_ADC_CV1(info->wake_rising);
+	} else {
+		cv = IMX6ULL_ADC_CV1(info->wake_falling);
+	}
+
+	writel(cfg_data, info->regs + IMX6ULL_REG_ADC_CFG);
+	writel(cv, info->regs + IMX6ULL_REG_ADC_CV);
+	writel(gc_data, info->regs + IMX6ULL_REG_ADC_GC);
+
+	info->wake_value = -1;
+	info->wake_armed = true;
+	/* 监视模式用上面自己的配置，不套用通道配置 */
+	info->conv_chan = info->wake_chan;
+	writel(IMX6ULL_ADC_AIEN | IMX6ULL_ADC_ADCHC(info->wake_chan),
+		info->regs + IMX6ULL_REG_ADC_HC0);
+
+	return enable_irq_wake(info->irq);
+}
+
 static int imx6ull_adc_suspend(struct device *dev)
 {
 	struct iio_dev *indio_dev = dev_get_drvdata(dev);
 	struct imx6ull_adc *info = iio_priv(indio_dev);
 	int hc_cfg;
 
+	/* 未完成的校准在 resume 时重新开始 */
+	cancel_delayed_work_sync(&info->cal_work);
+
+	/* 门限监视模式: 时钟和参考电压保持打开，ADC 继续工作 */
+	if (device_may_wakeup(dev) && !imx6ull_adc_arm_wakeup(info))
+		return 0;
+	info->wake_armed = false;
+
 	/* ADC controller enters to stop mode */
 	hc_cfg = readl(info->regs + IMX6ULL_REG_ADC_HC0);
 	hc_cfg |= IMX6ULL_ADC_CONV_DISABLE;
@@ -695,6 +4775,21 @@ static int imx6ull_adc_resume(struct device *dev)
 	struct imx6ull_adc *info = iio_priv(indio_dev);
 	int ret;
 
+	if (info->wake_armed) {
+		writel(IMX6ULL_ADC_CONV_DISABLE,
+			info->regs + IMX6ULL_REG_ADC_HC0);
+		disable_irq_wake(info->irq);
+		info->wake_armed = false;
+
+		if (info->wake_value >= 0)
+			dev_info(dev, "threshold wakeup, channel %d value %d\n",
+				info->wake_chan, info->wake_value);
+
+		/* 按 adc_feature 恢复 CFG/GC，同时清掉 ADCO/ACFE */
+		imx6ull_adc_hw_init(info);
+		return 0;
+	}
+
 	ret = regulator_enable(info->vref);
 	if (ret)
 		return ret;
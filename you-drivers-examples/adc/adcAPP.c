@@ -0,0 +1,344 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "sys/ioctl.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdint.h"
+#include "time.h"
+#include "poll.h"
+#include "sys/mman.h"
+#include "sched.h"
+#include "imx6ull_adc_ioctl.h"
+
+/*
+ * 用法: ./adcAPP /dev/imx6ull-adc0 <通道位图> <每次扫描数> <次数>
+ * 例:   ./adcAPP /dev/imx6ull-adc0 0x3 1 1000
+ *       每次 ioctl 读通道 0、1 各一个点，读 1000 次，统计每次调用耗时
+ *       最后可以再加输出格式 u16 (默认)、pack12 或 u8，例如
+ *       ./adcAPP /dev/imx6ull-adc0 0x3 512 1000 pack12
+ *
+ * 用法: ./adcAPP /dev/imx6ull-adc0 ring <通道数> <记录数>
+ *       mmap 环形缓冲，用 STREAM 采前几个通道，不用在 sysfs 里打开缓冲，
+ *       读够记录数后退出
+ *
+ * 用法: ./adcAPP /dev/imx6ull-adc0 stream <通道位图> <抽取倍率> <记录数>
+ *       作为独立的消费者自己启动采集，不用 sysfs，可以同时跑好几个
+ *       例如记录器 stream 0x3 1，控制环 stream 0x2 100
+ *
+ * 用法: ./adcAPP /dev/imx6ull-adc0 lat <实时优先级> <记录数> [通道位图]
+ *       用 STREAM 采通道位图里的通道 (默认 0x1)，统计从扫描时间戳到
+ *       这里拿到记录的延迟，类似 cyclictest，优先级为 0 时不改调度策略
+ */
+#define RING_LEN	(4096 + 1024 * sizeof(struct imx6ull_adc_ring_rec))
+#define LAT_HIST_US	1000
+
+static void *ring_map(const char *dev, struct pollfd *pfd)
+{
+	void *mem;
+
+	pfd->fd = open(dev, O_RDWR);
+	if (pfd->fd < 0) {
+		printf("can't open file %s\r\n", dev);
+		return NULL;
+	}
+
+	mem = mmap(NULL, RING_LEN, PROT_READ | PROT_WRITE, MAP_SHARED,
+		pfd->fd, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		close(pfd->fd);
+		return NULL;
+	}
+	pfd->events = POLLIN;
+
+	return mem;
+}
+
+/* 按 mask/decim 启动这个文件自己的采集，nchan 是 mask 里的通道数 */
+static int ring_main(const char *dev, unsigned int nchan, unsigned long total,
+		unsigned int mask, unsigned int decim)
+{
+	struct imx6ull_adc_ring_hdr *hdr;
+	struct imx6ull_adc_ring_rec *recs, *rec;
+	struct pollfd pfd;
+	unsigned long got = 0;
+	unsigned int head, tail, j, on = 1;
+	void *mem;
+
+	mem = ring_map(dev, &pfd);
+	if (!mem)
+		return -1;
+	hdr = mem;
+	recs = (void *)((char *)mem + 4096);
+
+	if (ioctl(pfd.fd, IMX6ULL_ADC_IOC_SET_CHANS, &mask) < 0 ||
+		ioctl(pfd.fd, IMX6ULL_ADC_IOC_SET_DECIM, &decim) < 0 ||
+		ioctl(pfd.fd, IMX6ULL_ADC_IOC_STREAM, &on) < 0) {
+		perror("start stream");
+		munmap(mem, RING_LEN);
+		close(pfd.fd);
+		return -1;
+	}
+
+	while (got < total) {
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		tail = hdr->tail;
+		if (head == tail) {
+			poll(&pfd, 1, 1000);
+			continue;
+		}
+
+		/* 直接在共享内存里处理，不拷贝 */
+		for (; tail != head && got < total; tail++, got++) {
+			rec = &recs[tail & (hdr->size - 1)];
+			if (rec->status & IMX6ULL_ADC_STATUS_GAP)
+				printf("gap: %u scans lost\r\n",
+					(rec->status & IMX6ULL_ADC_STATUS_LOST_MASK) >>
+					IMX6ULL_ADC_STATUS_LOST_SHIFT);
+			if (rec->status & IMX6ULL_ADC_STATUS_RATE_CHANGE)
+				printf("rate -> index %u\r\n",
+					(rec->status & IMX6ULL_ADC_STATUS_RATE_MASK) >>
+					IMX6ULL_ADC_STATUS_RATE_SHIFT);
+			if (got % 1000 == 0) {
+				printf("%lld:", (long long)rec->timestamp);
+				for (j = 0; j < nchan; j++)
+					printf(" %u", rec->data[j]);
+				printf("\r\n");
+			}
+		}
+		__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	printf("%lu records, %u dropped\r\n", got, hdr->dropped);
+	on = 0;
+	ioctl(pfd.fd, IMX6ULL_ADC_IOC_STREAM, &on);
+	munmap(mem, RING_LEN);
+	close(pfd.fd);
+	return 0;
+}
+
+/* 从直方图里找累计到 pct‰ 的延迟 */
+static unsigned int lat_percentile(const unsigned long *hist,
+				unsigned long n, unsigned int pct)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < LAT_HIST_US; i++) {
+		sum += hist[i];
+		if (sum * 1000 >= n * pct)
+			return i;
+	}
+	return LAT_HIST_US;
+}
+
+static int lat_main(const char *dev, int prio, unsigned long total,
+		unsigned int mask)
+{
+	static unsigned long hist[LAT_HIST_US + 1];
+	struct imx6ull_adc_ring_hdr *hdr;
+	struct imx6ull_adc_ring_rec *recs, *rec;
+	struct sched_param param;
+	struct pollfd pfd;
+	struct timespec now;
+	unsigned long got = 0, gaps = 0;
+	unsigned int head, tail, on = 1, decim = 1;
+	long long ns, min_ns = -1, max_ns = 0, sum_ns = 0;
+	void *mem;
+
+	if (!total)
+		return -1;
+
+	/* 先锁内存、提优先级，测的是最坏情况 */
+	mlockall(MCL_CURRENT | MCL_FUTURE);
+	if (prio > 0) {
+		param.sched_priority = prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+			perror("sched_setscheduler");
+	}
+
+	mem = ring_map(dev, &pfd);
+	if (!mem)
+		return -1;
+	hdr = mem;
+	recs = (void *)((char *)mem + 4096);
+
+	if (ioctl(pfd.fd, IMX6ULL_ADC_IOC_SET_CHANS, &mask) < 0 ||
+		ioctl(pfd.fd, IMX6ULL_ADC_IOC_SET_DECIM, &decim) < 0 ||
+		ioctl(pfd.fd, IMX6ULL_ADC_IOC_STREAM, &on) < 0) {
+		perror("start stream");
+		munmap(mem, RING_LEN);
+		close(pfd.fd);
+		return -1;
+	}
+
+	while (got < total) {
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		tail = hdr->tail;
+		if (head == tail) {
+			poll(&pfd, 1, 1000);
+			continue;
+		}
+
+		/* 时间戳是 iio_get_time_ns()，也就是 CLOCK_REALTIME */
+		clock_gettime(CLOCK_REALTIME, &now);
+		for (; tail != head && got < total; tail++, got++) {
+			rec = &recs[tail & (hdr->size - 1)];
+			if (rec->status & IMX6ULL_ADC_STATUS_GAP)
+				gaps++;
+
+			ns = (long long)now.tv_sec * 1000000000LL + now.tv_nsec -
+				rec->timestamp;
+			sum_ns += ns;
+			if (min_ns < 0 || ns < min_ns)
+				min_ns = ns;
+			if (ns > max_ns)
+				max_ns = ns;
+			hist[ns / 1000 < LAT_HIST_US ? ns / 1000 : LAT_HIST_US]++;
+		}
+		__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	on = 0;
+	ioctl(pfd.fd, IMX6ULL_ADC_IOC_STREAM, &on);
+
+	printf("%lu records, %lu gaps, %u dropped\r\n", got, gaps, hdr->dropped);
+	printf("latency us: min %lld avg %lld max %lld\r\n",
+		min_ns / 1000, sum_ns / (long long)got / 1000, max_ns / 1000);
+	printf("            99%% %u 99.9%% %u (%lu over %u us)\r\n",
+		lat_percentile(hist, got, 990), lat_percentile(hist, got, 999),
+		hist[LAT_HIST_US], LAT_HIST_US);
+
+	munmap(mem, RING_LEN);
+	close(pfd.fd);
+	return 0;
+}
+
+static int parse_fmt(const char *name)
+{
+	if (!strcmp(name, "u16"))
+		return IMX6ULL_ADC_FMT_U16;
+	if (!strcmp(name, "pack12"))
+		return IMX6ULL_ADC_FMT_PACK12;
+	if (!strcmp(name, "u8"))
+		return IMX6ULL_ADC_FMT_U8;
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, ret, fmt = IMX6ULL_ADC_FMT_U16;
+	unsigned int i, j, mask, scans, loops, nchan = 0;
+	struct imx6ull_adc_read_req req;
+	struct timespec t0, t1;
+	uint16_t *data;
+	uint8_t *raw;
+	long us, max_us = 0, sum_us = 0;
+
+	if (argc == 6 && !strcmp(argv[2], "stream")) {
+		mask = strtoul(argv[3], NULL, 0);
+		for (i = 0; i < 32; i++)
+			if (mask & (1u << i))
+				nchan++;
+		return ring_main(argv[1], nchan, strtoul(argv[5], NULL, 0),
+				mask, strtoul(argv[4], NULL, 0));
+	}
+
+	if ((argc == 5 || argc == 6) && !strcmp(argv[2], "lat"))
+		return lat_main(argv[1], atoi(argv[3]),
+				strtoul(argv[4], NULL, 0),
+				argc == 6 ? strtoul(argv[5], NULL, 0) : 0x1);
+
+	if (argc == 6)
+		fmt = parse_fmt(argv[5]);
+	if ((argc != 5 && argc != 6) || fmt < 0) {
+		printf("Usage: %s <dev> <chan_mask> <scans> <loops> [u16|pack12|u8]\r\n",
+			argv[0]);
+		printf("       %s <dev> ring <nchan> <records>\r\n", argv[0]);
+		printf("       %s <dev> stream <chan_mask> <decim> <records>\r\n",
+			argv[0]);
+		printf("       %s <dev> lat <prio> <records> [chan_mask]\r\n",
+			argv[0]);
+		return -1;
+	}
+
+	/* 前 nchan 个通道，不抽取 */
+	if (!strcmp(argv[2], "ring")) {
+		nchan = strtoul(argv[3], NULL, 0);
+		mask = nchan < 32 ? (1u << nchan) - 1 : ~0u;
+		return ring_main(argv[1], nchan, strtoul(argv[4], NULL, 0),
+				mask, 1);
+	}
+
+	mask = strtoul(argv[2], NULL, 0);
+	scans = strtoul(argv[3], NULL, 0);
+	loops = strtoul(argv[4], NULL, 0);
+	for (i = 0; i < 32; i++)
+		if (mask & (1u << i))
+			nchan++;
+
+	data = malloc(scans * nchan * sizeof(uint16_t));
+	raw = malloc(imx6ull_adc_fmt_bytes(fmt, scans * nchan));
+	if (!nchan || !data || !raw) {
+		printf("bad channel mask or out of memory\r\n");
+		return -1;
+	}
+
+	fd = open(argv[1], O_RDWR);
+	if (fd < 0) {
+		printf("can't open file %s\r\n", argv[1]);
+		return -1;
+	}
+
+	if (ioctl(fd, IMX6ULL_ADC_IOC_SET_FORMAT, &fmt) < 0) {
+		perror("IMX6ULL_ADC_IOC_SET_FORMAT");
+		close(fd);
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.chan_mask = mask;
+	req.count = scans;
+	req.data = (uintptr_t)raw;
+
+	for (i = 0; i < loops; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		ret = ioctl(fd, IMX6ULL_ADC_IOC_READ, &req);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (ret < 0) {
+			perror("IMX6ULL_ADC_IOC_READ");
+			break;
+		}
+
+		us = (t1.tv_sec - t0.tv_sec) * 1000000 +
+			(t1.tv_nsec - t0.tv_nsec) / 1000;
+		sum_us += us;
+		if (us > max_us)
+			max_us = us;
+	}
+
+	/* 还原成 u16 后打印最后一次读到的第一个扫描 */
+	if (fmt == IMX6ULL_ADC_FMT_PACK12)
+		imx6ull_adc_unpack12(raw, data, nchan);
+	else if (fmt == IMX6ULL_ADC_FMT_U8)
+		for (j = 0; j < nchan; j++)
+			data[j] = raw[j];
+	else
+		memcpy(data, raw, nchan * sizeof(uint16_t));
+	printf("last scan:");
+	for (j = 0; j < nchan; j++)
+		printf(" %u", data[j]);
+	printf("\r\n");
+	if (i)
+		printf("%u calls, avg %ld us, max %ld us, %u bytes per call\r\n",
+			i, sum_us / (long)i, max_us,
+			imx6ull_adc_fmt_bytes(fmt, scans * nchan));
+
+	free(raw);
+	free(data);
+	close(fd);
+	return 0;
+}
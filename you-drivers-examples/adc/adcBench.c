@@ -0,0 +1,669 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "sys/ioctl.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdint.h"
+#include "math.h"
+#include "errno.h"
+#include "poll.h"
+#include "sys/mman.h"
+#include "imx6ull_adc_ioctl.h"
+
+/*
+ * 转换器质量测试: 遍历分辨率、ADCK 分频和硬件平均的所有组合，
+ * 每种组合高速采一段，统计码值直方图，算噪声、ENOB、DNL、INL，
+ * 和实测的采样率一起列成表，用来挑速度/精度合适的设置
+ *
+ * 用法: ./adcBench /dev/imx6ull-adc0 /sys/bus/iio/devices/iio:device0 \
+ *                  <通道> <dc|ramp|sine> [样本数]
+ *       ./adcBench synth <dc|ramp|sine> [样本数]
+ *
+ * 输入信号:
+ * dc    接一个稳定的直流电压，算噪声和 ENOB
+ * ramp  接一个慢速、覆盖满量程的三角波/锯齿波，码值密度法算 DNL/INL
+ * sine  接一个略超满量程的正弦波，按正弦分布的码值密度算 DNL/INL，
+ *       再拟合正弦，用残差算 ENOB
+ *
+ * synth 不用板子，按驱动里的转换时间公式和一个简单的噪声、DNL 模型
+ * 生成数据，用来检查这个程序本身
+ */
+#define BENCH_DEF_SAMPLES	262144
+#define BENCH_RING_RECS		16384
+#define BENCH_RING_LEN		(4096 + BENCH_RING_RECS * \
+				sizeof(struct imx6ull_adc_ring_rec))
+#define BENCH_MAX_LIST		8
+/* 换分频后驱动重新校准，最多等这么多次 10ms */
+#define BENCH_CAL_TRIES		100
+
+/* synth 用: 和驱动一样的 ipg 时钟、ADCK 上限 (默认的低功耗模式) 和转换时间公式 */
+#define SYNTH_IPG_HZ		66000000.0
+#define SYNTH_ADCK_MAX		20000000.0
+
+enum wave { WAVE_DC, WAVE_RAMP, WAVE_SINE };
+
+struct bench_cfg {
+	int res;
+	int div;
+	int avg;
+	double fs;
+};
+
+struct bench_result {
+	double rate;
+	double mean;
+	double sigma;
+	double enob;
+	double dnl;
+	double inl;
+	int missing;
+	unsigned long lost;
+};
+
+static const int synth_avgs[] = { 1, 4, 8, 16, 32 };
+
+/* ---------- sysfs ---------- */
+
+static int sysfs_write(const char *dir, const char *name, const char *val)
+{
+	char path[256];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		printf("can't open file %s\r\n", path);
+		return -1;
+	}
+	ret = write(fd, val, strlen(val));
+	close(fd);
+	if (ret < 0) {
+		printf("write %s to %s failed\r\n", val, path);
+		return -1;
+	}
+	return 0;
+}
+
+static int sysfs_read(const char *dir, const char *name, char *buf, int len)
+{
+	char path[256];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("can't open file %s\r\n", path);
+		return -1;
+	}
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	return 0;
+}
+
+/* 读 "a b c" 形式的 _available 属性 */
+static int sysfs_list(const char *dir, const char *name, long *vals)
+{
+	char buf[128], *p, *end;
+	int n = 0;
+
+	if (sysfs_read(dir, name, buf, sizeof(buf)))
+		return -1;
+
+	for (p = buf; n < BENCH_MAX_LIST; p = end) {
+		vals[n] = strtol(p, &end, 0);
+		if (end == p)
+			break;
+		n++;
+	}
+	return n;
+}
+
+static int sysfs_write_long(const char *dir, const char *name, long val)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%ld", val);
+	return sysfs_write(dir, name, buf);
+}
+
+/* ---------- 数据来源 ---------- */
+
+/*
+ * 用字符设备的 STREAM 采一个通道 (驱动里单通道自由运行时用连续转换)，
+ * 丢失的样本数记在 lost 里，返回采到的样本数
+ */
+static long capture_dev(const char *dev, unsigned int chan, long total,
+			uint16_t *data, int64_t *ts, unsigned long *lost)
+{
+	struct imx6ull_adc_ring_hdr *hdr;
+	struct imx6ull_adc_ring_rec *recs, *rec;
+	struct pollfd pfd;
+	unsigned int head, tail, on = 1, mask = 1u << chan, decim = 1;
+	long got = 0;
+	void *mem;
+	int ret, tries = 0;
+
+	pfd.fd = open(dev, O_RDWR);
+	if (pfd.fd < 0) {
+		printf("can't open file %s\r\n", dev);
+		return -1;
+	}
+	pfd.events = POLLIN;
+
+	mem = mmap(NULL, BENCH_RING_LEN, PROT_READ | PROT_WRITE, MAP_SHARED,
+		pfd.fd, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		close(pfd.fd);
+		return -1;
+	}
+	hdr = mem;
+	recs = (void *)((char *)mem + 4096);
+
+	/* 刚换过分频时驱动还在校准，STREAM 返回 EBUSY，等一会再试 */
+	ret = ioctl(pfd.fd, IMX6ULL_ADC_IOC_SET_CHANS, &mask);
+	if (!ret)
+		ret = ioctl(pfd.fd, IMX6ULL_ADC_IOC_SET_DECIM, &decim);
+	while (!ret) {
+		ret = ioctl(pfd.fd, IMX6ULL_ADC_IOC_STREAM, &on);
+		if (!ret || errno != EBUSY || ++tries >= BENCH_CAL_TRIES)
+			break;
+		usleep(10000);
+	}
+	if (ret < 0) {
+		perror("start stream");
+		got = -1;
+		goto out;
+	}
+
+	*lost = 0;
+	while (got < total) {
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		tail = hdr->tail;
+		if (head == tail) {
+			if (poll(&pfd, 1, 1000) == 0) {
+				printf("no data\r\n");
+				break;
+			}
+			continue;
+		}
+
+		for (; tail != head && got < total; tail++, got++) {
+			rec = &recs[tail & (hdr->size - 1)];
+			data[got] = rec->data[0];
+			ts[got] = rec->timestamp;
+			if (rec->status & IMX6ULL_ADC_STATUS_GAP)
+				*lost += (rec->status &
+					IMX6ULL_ADC_STATUS_LOST_MASK) >>
+					IMX6ULL_ADC_STATUS_LOST_SHIFT;
+		}
+		__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+	}
+	*lost += hdr->dropped;
+
+	on = 0;
+	ioctl(pfd.fd, IMX6ULL_ADC_IOC_STREAM, &on);
+out:
+	munmap(mem, BENCH_RING_LEN);
+	close(pfd.fd);
+	return got;
+}
+
+static double gauss(void)
+{
+	double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/*
+ * 模拟的转换器: 12 位刻度下 0.8 LSB 的白噪声，ADCK 越快噪声越大，
+ * 硬件平均按 sqrt(N) 降噪；每 512 个 12 位码有一个宽 0.4 LSB 的台阶
+ */
+static long capture_synth(const struct bench_cfg *c, enum wave wave,
+			long total, uint16_t *data, int64_t *ts)
+{
+	double fs_code = 1 << c->res, lsb12 = fs_code / 4096.0;
+	double sigma, x, t, y;
+	long i;
+	int code;
+
+	sigma = 0.8 * lsb12 * (1.0 + 2.0 / c->div) / sqrt(c->avg);
+
+	for (i = 0; i < total; i++) {
+		t = i / c->fs;
+		switch (wave) {
+		case WAVE_DC:
+			x = 0.37 * fs_code;
+			break;
+		case WAVE_RAMP:
+			/* 整段里一个来回 */
+			y = 2.0 * i / total;
+			x = (y < 1.0 ? y : 2.0 - y) * fs_code;
+			break;
+		default:
+			x = fs_code / 2 + 0.52 * fs_code *
+				sin(2 * M_PI * 37.3 * i / total);
+			break;
+		}
+		x += sigma * gauss();
+
+		/* 台阶: 过了每个 512 码边界的输入都往下挪 0.4 个 12 位 LSB */
+		x -= 0.4 * lsb12 * floor(x / (512 * lsb12));
+
+		code = (int)floor(x);
+		if (code < 0)
+			code = 0;
+		if (code >= (int)fs_code)
+			code = fs_code - 1;
+		data[i] = code;
+		ts[i] = (int64_t)(t * 1e9);
+	}
+	return total;
+}
+
+/* ---------- 分析 ---------- */
+
+/* 码值密度法: 由累计直方图求各码的跳变电平，算 DNL、INL 和缺码 */
+static void analyze_density(const unsigned long *hist, int codes, long n,
+			enum wave wave, struct bench_result *r)
+{
+	double *t, c = 0, w, avg;
+	int lo, hi, k;
+
+	r->dnl = r->inl = NAN;
+	r->missing = 0;
+
+	for (lo = 0; lo < codes && !hist[lo]; lo++)
+		;
+	for (hi = codes - 1; hi > lo && !hist[hi]; hi--)
+		;
+	/* 两端的码吃掉了超量程的部分，不算 */
+	if (hi - lo < 4)
+		return;
+
+	t = calloc(codes + 1, sizeof(*t));
+	if (!t)
+		return;
+
+	for (k = 0; k <= hi; k++) {
+		if (k > lo)
+			t[k] = wave == WAVE_SINE ? -cos(M_PI * c / n) : c / n;
+		c += hist[k];
+	}
+
+	avg = (t[hi] - t[lo + 1]) / (hi - lo - 1);
+	r->dnl = r->inl = 0;
+	for (k = lo + 1; k < hi; k++) {
+		w = (t[k + 1] - t[k]) / avg - 1.0;
+		if (fabs(w) > fabs(r->dnl))
+			r->dnl = w;
+		if (!hist[k])
+			r->missing++;
+	}
+	/* 端点拟合 */
+	for (k = lo + 1; k <= hi; k++) {
+		w = (t[k] - t[lo + 1]) / avg - (k - lo - 1);
+		if (fabs(w) > fabs(r->inl))
+			r->inl = w;
+	}
+
+	free(t);
+}
+
+/* 解 3x3 线性方程组 (高斯消元)，奇异时返回 -1 */
+static int solve3(double a[3][3], double b[3], double x[3])
+{
+	double f;
+	int i, j, k;
+
+	for (i = 0; i < 3; i++) {
+		for (k = i + 1, j = i; k < 3; k++)
+			if (fabs(a[k][i]) > fabs(a[j][i]))
+				j = k;
+		if (fabs(a[j][i]) < 1e-12)
+			return -1;
+		for (k = 0; k < 3; k++) {
+			f = a[i][k]; a[i][k] = a[j][k]; a[j][k] = f;
+		}
+		f = b[i]; b[i] = b[j]; b[j] = f;
+
+		for (j = i + 1; j < 3; j++) {
+			f = a[j][i] / a[i][i];
+			for (k = i; k < 3; k++)
+				a[j][k] -= f * a[i][k];
+			b[j] -= f * b[i];
+		}
+	}
+
+	for (i = 2; i >= 0; i--) {
+		x[i] = b[i];
+		for (k = i + 1; k < 3; k++)
+			x[i] -= a[i][k] * x[k];
+		x[i] /= a[i][i];
+	}
+	return 0;
+}
+
+/*
+ * 从 start 开始找下一个穿过 mean 的上升沿，先要低于 mean - hyst，
+ * 慢速正弦在均值附近的噪声不会算成好几次过零；找不到时返回 n
+ */
+static long next_rising(const uint16_t *d, long n, long start, double mean,
+			double hyst)
+{
+	int armed = 0;
+	long i;
+
+	for (i = start; i < n; i++) {
+		if (d[i] < mean - hyst)
+			armed = 1;
+		else if (armed && d[i] >= mean && i > 0)
+			return i;
+	}
+	return n;
+}
+
+/*
+ * 正弦拟合: 频率由穿过均值的上升沿估计，再按已知频率做
+ * 三参数最小二乘，残差 (LSB) 算 ENOB；削顶的样本不参加拟合
+ */
+static double sine_enob(const uint16_t *d, const int64_t *ts, long n,
+			int res, double mean, double hyst)
+{
+	double a[3][3] = { { 0 } }, b[3] = { 0 }, x[3], basis[3];
+	double t0 = 0, t1 = 0, tc, w, e, err = 0;
+	long i, crossings = 0, used = 0;
+	int j, k, top = (1 << res) - 1;
+
+	for (i = next_rising(d, n, 0, mean, hyst); i < n;
+		i = next_rising(d, n, i, mean, hyst)) {
+		tc = ts[i - 1] + (ts[i] - ts[i - 1]) *
+			(mean - d[i - 1]) / (d[i] - d[i - 1]);
+		if (!crossings)
+			t0 = tc;
+		t1 = tc;
+		crossings++;
+	}
+	if (crossings < 3)
+		return NAN;
+	w = 2 * M_PI * (crossings - 1) / ((t1 - t0) * 1e-9);
+
+	for (i = 0; i < n; i++) {
+		if (d[i] == 0 || d[i] == top)
+			continue;
+		basis[0] = cos(w * (ts[i] - ts[0]) * 1e-9);
+		basis[1] = sin(w * (ts[i] - ts[0]) * 1e-9);
+		basis[2] = 1.0;
+		for (j = 0; j < 3; j++) {
+			for (k = 0; k < 3; k++)
+				a[j][k] += basis[j] * basis[k];
+			b[j] += basis[j] * d[i];
+		}
+	}
+	if (solve3(a, b, x))
+		return NAN;
+
+	for (i = 0; i < n; i++) {
+		if (d[i] == 0 || d[i] == top)
+			continue;
+		e = d[i] - (x[0] * cos(w * (ts[i] - ts[0]) * 1e-9) +
+			x[1] * sin(w * (ts[i] - ts[0]) * 1e-9) + x[2]);
+		err += e * e;
+		used++;
+	}
+	if (!used)
+		return NAN;
+
+	/* 理想量化器的残差是 1/sqrt(12) LSB */
+	e = sqrt(err / used);
+	return fmin(res, res - log2(e * sqrt(12.0)));
+}
+
+/*
+ * 正弦的码值密度要用整数个周期，否则多出的半截周期会在 INL 上
+ * 表现成一个弓形；取第一个和最后一个穿过均值的上升沿之间
+ */
+static void sine_span(const uint16_t *d, long n, double mean, double hyst,
+		long *first, long *last)
+{
+	long i;
+
+	*first = next_rising(d, n, 0, mean, hyst);
+	*last = n;
+	for (i = *first; i < n; i = next_rising(d, n, i, mean, hyst))
+		*last = i;
+
+	if (*first >= n || *last <= *first) {
+		*first = 0;
+		*last = n;
+	}
+}
+
+static void analyze(const uint16_t *d, const int64_t *ts, long n, int res,
+		enum wave wave, struct bench_result *r)
+{
+	int codes = 1 << res;
+	unsigned long *hist;
+	double sum = 0, sq = 0;
+	long i, first = 0, last = n;
+
+	hist = calloc(codes, sizeof(*hist));
+	if (!hist)
+		return;
+
+	for (i = 0; i < n; i++)
+		sum += d[i];
+	r->mean = sum / n;
+	for (i = 0; i < n; i++)
+		sq += (d[i] - r->mean) * (d[i] - r->mean);
+	r->sigma = sqrt(sq / n);
+
+	/* 过零回差取信号标准差的 1/10 */
+	if (wave == WAVE_SINE)
+		sine_span(d, n, r->mean, r->sigma / 10, &first, &last);
+	for (i = first; i < last; i++)
+		hist[d[i] & (codes - 1)]++;
+
+	r->rate = n > 1 && ts[n - 1] > ts[0] ?
+		(n - 1) * 1e9 / (ts[n - 1] - ts[0]) : 0;
+
+	switch (wave) {
+	case WAVE_DC:
+		/* 噪声为 0 时是 res 位，噪声大时是 res - log2(sigma * sqrt(12)) */
+		r->enob = res - 0.5 * log2(1.0 + 12.0 * r->sigma * r->sigma);
+		r->dnl = r->inl = NAN;
+		r->missing = -1;
+		break;
+	case WAVE_RAMP:
+		r->enob = NAN;
+		analyze_density(hist, codes, n, wave, r);
+		break;
+	default:
+		r->enob = sine_enob(d, ts, n, res, r->mean, r->sigma / 10);
+		analyze_density(hist, codes, last - first, wave, r);
+		break;
+	}
+
+	free(hist);
+}
+
+static void print_row(const struct bench_cfg *c, const struct bench_result *r)
+{
+	printf("%3d %4d %4d %10.0f %10.0f %9.2f %7.3f %6.2f %7.3f %7.3f",
+		c->res, c->div, c->avg, c->fs, r->rate, r->mean, r->sigma,
+		r->enob, r->dnl, r->inl);
+	if (r->missing >= 0)
+		printf(" %5d", r->missing);
+	else
+		printf("     -");
+	printf(" %6lu\r\n", r->lost);
+}
+
+static void print_header(void)
+{
+	printf("res  div  avg    nominal   measured      mean   sigma   ENOB"
+		"     DNL     INL  miss   lost\r\n");
+}
+
+/* ---------- 遍历 ---------- */
+
+static int bench_synth(enum wave wave, long n, uint16_t *data, int64_t *ts)
+{
+	struct bench_cfg c;
+	struct bench_result r;
+	int res, div, i;
+
+	print_header();
+	for (res = 8; res <= 12; res += 2) {
+		for (div = 1; div <= 16; div *= 2) {
+			if (SYNTH_IPG_HZ / div > SYNTH_ADCK_MAX)
+				continue;
+			for (i = 0; i < 5; i++) {
+				c.res = res;
+				c.div = div;
+				c.avg = synth_avgs[i];
+				c.fs = SYNTH_IPG_HZ / div /
+					(6 + c.avg * (2 * res + 1 + 3));
+				memset(&r, 0, sizeof(r));
+				capture_synth(&c, wave, n, data, ts);
+				analyze(data, ts, n, res, wave, &r);
+				print_row(&c, &r);
+			}
+		}
+	}
+	return 0;
+}
+
+static int bench_dev(const char *dev, const char *dir, unsigned int chan,
+		enum wave wave, long n, uint16_t *data, int64_t *ts)
+{
+	long res_list[BENCH_MAX_LIST], div_list[BENCH_MAX_LIST];
+	long freq_list[BENCH_MAX_LIST];
+	char old_res[16], old_div[16], old_freq[32];
+	int nres, ndiv, nfreq, i, j, k, ret = 0;
+	struct bench_cfg c;
+	struct bench_result r;
+	long got;
+
+	if (sysfs_read(dir, "in_voltage_resolution", old_res, sizeof(old_res)) ||
+		sysfs_read(dir, "clock_divider", old_div, sizeof(old_div)) ||
+		sysfs_read(dir, "in_voltage_sampling_frequency", old_freq,
+			sizeof(old_freq)))
+		return -1;
+
+	nres = sysfs_list(dir, "in_voltage_resolution_available", res_list);
+	ndiv = sysfs_list(dir, "clock_divider_available", div_list);
+	if (nres <= 0 || ndiv <= 0)
+		return -1;
+
+	/* 软件过采样会改变输出位数，测的是硬件本身 */
+	if (sysfs_write(dir, "oversampling_ratio", "1"))
+		return -1;
+
+	print_header();
+	for (i = 0; i < nres && !ret; i++) {
+		for (j = 0; j < ndiv && !ret; j++) {
+			if (sysfs_write_long(dir, "in_voltage_resolution",
+					res_list[i]) ||
+				sysfs_write_long(dir, "clock_divider",
+					div_list[j])) {
+				ret = -1;
+				break;
+			}
+
+			/* 分辨率、分频变了采样率表也变，每次重新读 */
+			nfreq = sysfs_list(dir, "sampling_frequency_available",
+					freq_list);
+			for (k = 0; k < nfreq; k++) {
+				if (sysfs_write_long(dir,
+					"in_voltage_sampling_frequency",
+					freq_list[k])) {
+					ret = -1;
+					break;
+				}
+
+				c.res = res_list[i];
+				c.div = div_list[j];
+				c.avg = synth_avgs[k];
+				c.fs = freq_list[k];
+				memset(&r, 0, sizeof(r));
+				got = capture_dev(dev, chan, n, data, ts, &r.lost);
+				if (got < 2) {
+					ret = -1;
+					break;
+				}
+				analyze(data, ts, got, c.res, wave, &r);
+				print_row(&c, &r);
+			}
+		}
+	}
+
+	sysfs_write(dir, "in_voltage_resolution", old_res);
+	sysfs_write(dir, "clock_divider", old_div);
+	sysfs_write(dir, "in_voltage_sampling_frequency", old_freq);
+	return ret;
+}
+
+static int parse_wave(const char *name)
+{
+	if (!strcmp(name, "dc"))
+		return WAVE_DC;
+	if (!strcmp(name, "ramp"))
+		return WAVE_RAMP;
+	if (!strcmp(name, "sine"))
+		return WAVE_SINE;
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	int synth = argc >= 3 && !strcmp(argv[1], "synth");
+	long n = BENCH_DEF_SAMPLES;
+	uint16_t *data;
+	int64_t *ts;
+	int wave, ret;
+
+	if (synth) {
+		wave = parse_wave(argv[2]);
+		if (argc == 4)
+			n = strtol(argv[3], NULL, 0);
+	} else if (argc == 5 || argc == 6) {
+		wave = parse_wave(argv[4]);
+		if (argc == 6)
+			n = strtol(argv[5], NULL, 0);
+	} else {
+		wave = -1;
+	}
+
+	if (wave < 0 || n < 16) {
+		printf("Usage: %s <dev> <iio sysfs dir> <chan> dc|ramp|sine [samples]\r\n",
+			argv[0]);
+		printf("       %s synth dc|ramp|sine [samples]\r\n", argv[0]);
+		return -1;
+	}
+
+	data = malloc(n * sizeof(*data));
+	ts = malloc(n * sizeof(*ts));
+	if (!data || !ts) {
+		printf("out of memory\r\n");
+		return -1;
+	}
+
+	if (synth)
+		ret = bench_synth(wave, n, data, ts);
+	else
+		ret = bench_dev(argv[1], argv[2], strtoul(argv[3], NULL, 0),
+				wave, n, data, ts);
+
+	free(ts);
+	free(data);
+	return ret;
+}
@@ -0,0 +1,128 @@
+#ifndef _IMX6ULL_ADC_IOCTL_H
+#define _IMX6ULL_ADC_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * /dev/imx6ull-adcN 的二进制接口，驱动和应用程序共用这个头文件
+ *
+ * 通道集合用位图表示，bit N 对应 in_voltageN。一次扫描按通道号从小到大
+ * 每个通道输出一个 __u16，数值和 in_voltageN_raw 相同 (含软件过采样)
+ *
+ * read():  按 SET_CHANS 设置的集合 (默认全部通道) 做 len 字节能放下的
+ *          扫描次数，返回读到的字节数；SET_FORMAT 可以换成紧凑格式
+ * ioctl(): IMX6ULL_ADC_IOC_READ 可以单独指定这一次的通道集合
+ */
+#define IMX6ULL_ADC_IOC_MAGIC		'A'
+
+/* 一次调用最多的扫描次数 */
+#define IMX6ULL_ADC_READ_MAX_SCANS	1024
+
+struct imx6ull_adc_read_req {
+	__u32 chan_mask;	/* 为 0 时用 SET_CHANS 设置的集合 */
+	__u32 count;		/* 扫描次数 */
+	__u64 data;		/* 用户缓冲区，imx6ull_adc_fmt_bytes(格式, count * 通道数) 字节 */
+};
+
+/*
+ * mmap() 得到的共享环形缓冲，缓冲模式打开时中断每输出一个扫描写一条记录
+ *
+ *   偏移 0:          struct imx6ull_adc_ring_hdr
+ *   偏移 PAGE_SIZE:  size 条 struct imx6ull_adc_ring_rec
+ *
+ * head 只由驱动写，tail 只由应用写，都是不回绕的计数，
+ * 下标取 (x & (size - 1))。环满时丢掉新记录并增加 dropped，
+ * 不会覆盖应用还没读的记录。环空时用 poll() 等待
+ *
+ * 每个打开的文件是一个独立的消费者，有自己的环、通道集合 (SET_CHANS)
+ * 和抽取倍率 (SET_DECIM)。STREAM 打开后驱动按所有消费者通道的并集
+ * 启动采集，不需要在 sysfs 里打开缓冲；每个环只收到自己的通道
+ */
+struct imx6ull_adc_ring_hdr {
+	__u32 head;		/* 驱动写: 下一条要写的记录 */
+	__u32 tail;		/* 应用写: 下一条要读的记录 */
+	__u32 size;		/* 记录条数，2 的幂 */
+	__u32 rec_bytes;	/* sizeof(struct imx6ull_adc_ring_rec) */
+	__u32 dropped;		/* 环满丢掉的记录数 */
+};
+
+struct imx6ull_adc_ring_rec {
+	__s64 timestamp;	/* 扫描开始的时刻 (ns)，抽取时是第一个扫描的 */
+	__u16 data[2];		/* SET_CHANS 集合里正在采集的通道，按通道号排列 */
+	__u16 reserved;		/* 填充，保持记录 16 字节，驱动写 0 */
+	__u16 status;		/* 状态字，见下面的 IMX6ULL_ADC_STATUS_* */
+};
+
+/*
+ * 环形缓冲记录里的状态字
+ *
+ * RATE_CHANGE: 从这个扫描开始换了采样率
+ * GAP:         这个扫描之前丢了 LOST 个扫描 (超过 255 时为 255)
+ * RATE:        当前采样率在 sampling_frequency_available 里的下标
+ */
+#define IMX6ULL_ADC_STATUS_RATE_CHANGE	0x0001
+#define IMX6ULL_ADC_STATUS_GAP		0x0002
+#define IMX6ULL_ADC_STATUS_RATE_SHIFT	4
+#define IMX6ULL_ADC_STATUS_RATE_MASK	0x0070
+#define IMX6ULL_ADC_STATUS_LOST_SHIFT	8
+#define IMX6ULL_ADC_STATUS_LOST_MASK	0xff00
+
+#define IMX6ULL_ADC_IOC_SET_CHANS	_IOW(IMX6ULL_ADC_IOC_MAGIC, 0, __u32)
+#define IMX6ULL_ADC_IOC_GET_CHANS	_IOR(IMX6ULL_ADC_IOC_MAGIC, 1, __u32)
+#define IMX6ULL_ADC_IOC_READ		_IOW(IMX6ULL_ADC_IOC_MAGIC, 2, \
+					struct imx6ull_adc_read_req)
+/* 每 N 个扫描平均成一条记录，默认 1，最大 IMX6ULL_ADC_MAX_DECIM */
+#define IMX6ULL_ADC_IOC_SET_DECIM	_IOW(IMX6ULL_ADC_IOC_MAGIC, 3, __u32)
+/* 1 开始、0 停止这个消费者的采集，要先 mmap 环 */
+#define IMX6ULL_ADC_IOC_STREAM		_IOW(IMX6ULL_ADC_IOC_MAGIC, 4, __u32)
+
+#define IMX6ULL_ADC_MAX_DECIM		65536
+
+/*
+ * read() 和 IMX6ULL_ADC_IOC_READ 的输出格式，样本顺序不变，默认 U16
+ *
+ * U16:    每个样本一个 __u16
+ * PACK12: 每两个样本 a、b 占 3 字节，比 U16 省 25%
+ *         b0 = a[7:0]，b1 = a[11:8] | b[3:0] << 4，b2 = b[11:4]
+ *         样本总数是奇数时最后一个样本占 2 字节
+ * U8:     每个样本一个字节，要先把 in_voltage_resolution 设成 8
+ *
+ * 输出位数 (分辨率 + 过采样) 超过格式能放下的位数时读取返回 -EINVAL。
+ * mmap 的环形缓冲不受影响，记录格式不变
+ */
+#define IMX6ULL_ADC_FMT_U16		0
+#define IMX6ULL_ADC_FMT_PACK12		1
+#define IMX6ULL_ADC_FMT_U8		2
+
+#define IMX6ULL_ADC_IOC_SET_FORMAT	_IOW(IMX6ULL_ADC_IOC_MAGIC, 5, __u32)
+
+/* n 个样本按 fmt 格式占的字节数 */
+static inline __u32 imx6ull_adc_fmt_bytes(__u32 fmt, __u32 n)
+{
+	switch (fmt) {
+	case IMX6ULL_ADC_FMT_PACK12:
+		return (3 * n + 1) / 2;
+	case IMX6ULL_ADC_FMT_U8:
+		return n;
+	default:
+		return 2 * n;
+	}
+}
+
+#ifndef __KERNEL__
+/* 应用程序用: 把 PACK12 格式的 n 个样本还原成 __u16 */
+static inline void imx6ull_adc_unpack12(const __u8 *src, __u16 *dst, __u32 n)
+{
+	__u32 i;
+
+	for (i = 0; i + 1 < n; i += 2, src += 3) {
+		dst[i] = src[0] | (src[1] & 0x0f) << 8;
+		dst[i + 1] = src[1] >> 4 | src[2] << 4;
+	}
+	if (i < n)
+		dst[i] = src[0] | (src[1] & 0x0f) << 8;
+}
+#endif
+
+#endif
@@ -1,23 +1,139 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/io.h>
+#include <linux/interrupt.h>
+#include <linux/spinlock.h>
+#include <linux/clk.h>
+#include <linux/uio_driver.h>
 
 #define IMX6ULL_PLATFORM_NAME "imx6ull-platform"
 
+/*
+ * 把设备树里描述的一段寄存器和它的中断通过 UIO 交给用户态，
+ * 例如 ADC1，用户态直接读写寄存器，每个样本不用一次系统调用
+ *
+ * 寄存器: /dev/uioX 的 map0，用 mmap 映射
+ * 中断:   read() /dev/uioX 等中断，write() 1 重新打开中断
+ *
+ * 中断来了之后先关掉，用户态读完结果 (清掉中断源) 再打开，
+ * 否则电平中断在用户态处理之前会一直进来
+ */
+struct imx6ull_platform {
+	struct uio_info uio;
+	struct clk *clk;
+	spinlock_t lock;
+	unsigned long flags;
+};
+
+/* flags 里的位 */
+#define IMX6ULL_PLATFORM_IRQ_DISABLED	0
+
 static const struct of_device_id imx6ull_platform_match[] = {
     { .compatible = "nxp,imx6ull-platform", },
     { /* sentinel */ }
 };
 
+static irqreturn_t imx6ull_platform_irq(int irq, struct uio_info *info)
+{
+    struct imx6ull_platform *priv = info->priv;
+
+    spin_lock(&priv->lock);
+    if (!__test_and_set_bit(IMX6ULL_PLATFORM_IRQ_DISABLED, &priv->flags))
+        disable_irq_nosync(irq);
+    spin_unlock(&priv->lock);
+
+    return IRQ_HANDLED;
+}
+
+static int imx6ull_platform_irqcontrol(struct uio_info *info, s32 irq_on)
+{
+    struct imx6ull_platform *priv = info->priv;
+    unsigned long flags;
+
+    spin_lock_irqsave(&priv->lock, flags);
+    if (irq_on) {
+        if (__test_and_clear_bit(IMX6ULL_PLATFORM_IRQ_DISABLED, &priv->flags))
+            enable_irq(info->irq);
+    } else {
+        if (!__test_and_set_bit(IMX6ULL_PLATFORM_IRQ_DISABLED, &priv->flags))
+            disable_irq_nosync(info->irq);
+    }
+    spin_unlock_irqrestore(&priv->lock, flags);
+
+    return 0;
+}
+
 static int imx6ull_platform_probe(struct platform_device *pdev)
 {
-    printk(KERN_INFO "IMX6ULL PLATFORM Driver Probed\n");
+    struct imx6ull_platform *priv;
+    struct resource *mem;
+    int irq, ret;
+
+    priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
+    if (!priv)
+        return -ENOMEM;
+
+    /* UIO 按页映射，寄存器块的起始地址要页对齐 */
+    mem = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+    if (!mem || (mem->start & ~PAGE_MASK)) {
+        dev_err(&pdev->dev, "missing or unaligned register block\n");
+        return -EINVAL;
+    }
+
+    irq = platform_get_irq(pdev, 0);
+    if (irq < 0) {
+        dev_err(&pdev->dev, "no irq resource?\n");
+        return irq;
+    }
+
+    /* 寄存器要有时钟才能访问，在驱动里一直打开 */
+    priv->clk = devm_clk_get(&pdev->dev, NULL);
+    if (IS_ERR(priv->clk)) {
+        dev_err(&pdev->dev, "failed getting clock, err = %ld\n",
+                PTR_ERR(priv->clk));
+        return PTR_ERR(priv->clk);
+    }
+
+    ret = clk_prepare_enable(priv->clk);
+    if (ret)
+        return ret;
+
+    spin_lock_init(&priv->lock);
+    priv->uio.name = IMX6ULL_PLATFORM_NAME;
+    priv->uio.version = "1.0";
+    priv->uio.mem[0].name = "regs";
+    priv->uio.mem[0].addr = mem->start;
+    priv->uio.mem[0].size = resource_size(mem);
+    priv->uio.mem[0].memtype = UIO_MEM_PHYS;
+    priv->uio.irq = irq;
+    priv->uio.handler = imx6ull_platform_irq;
+    priv->uio.irqcontrol = imx6ull_platform_irqcontrol;
+    priv->uio.priv = priv;
+
+    ret = uio_register_device(&pdev->dev, &priv->uio);
+    if (ret) {
+        dev_err(&pdev->dev, "failed registering uio device\n");
+        clk_disable_unprepare(priv->clk);
+        return ret;
+    }
+
+    platform_set_drvdata(pdev, priv);
+    dev_info(&pdev->dev, "regs 0x%llx size 0x%llx irq %d\n",
+             (unsigned long long)mem->start,
+             (unsigned long long)resource_size(mem), irq);
+
     return 0;
 }
 
 static int imx6ull_platform_remove(struct platform_device *pdev)
 {
-    printk(KERN_INFO "IMX6ULL PLATFORM Driver Removed\n");
+    struct imx6ull_platform *priv = platform_get_drvdata(pdev);
+
+    uio_unregister_device(&priv->uio);
+    clk_disable_unprepare(priv->clk);
+
     return 0;
 }
 
@@ -35,4 +151,4 @@ module_platform_driver(imx6ull_platform_driver);
 
 MODULE_AUTHOR("SakoroYou");
 MODULE_DESCRIPTION("YOU IMX6ULL PLATFORM Driver");
-MODULE_LICENSE("GPL v2");
\ No newline at end of file
+MODULE_LICENSE("GPL v2");
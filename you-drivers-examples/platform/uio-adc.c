@@ -0,0 +1,119 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "string.h"
+#include "stdlib.h"
+#include "sys/mman.h"
+#include "uio-adc.h"
+
+#define REG(adc, off)	((adc)->regs[(off) / 4])
+
+/* 忙等的上限，防止时钟没开或者通道不对时卡死 */
+#define UIO_ADC_SPIN_MAX	1000000
+
+/* /dev/uio0 -> /sys/class/uio/uio0/maps/map0/size */
+static long uio_map_size(const char *dev)
+{
+	const char *name = strrchr(dev, '/');
+	char path[64], buf[32];
+	int fd, len;
+
+	snprintf(path, sizeof(path), "/sys/class/uio/%s/maps/map0/size",
+		name ? name + 1 : dev);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	return strtol(buf, NULL, 0);
+}
+
+int uio_adc_open(struct uio_adc *adc, const char *dev)
+{
+	long size = uio_map_size(dev);
+	void *mem;
+
+	if (size <= 0) {
+		printf("can't get map size of %s\r\n", dev);
+		return -1;
+	}
+
+	adc->fd = open(dev, O_RDWR);
+	if (adc->fd < 0) {
+		printf("can't open file %s\r\n", dev);
+		return -1;
+	}
+
+	/* UIO 用 offset 选 map，map0 就是 0 */
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, adc->fd, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		close(adc->fd);
+		return -1;
+	}
+
+	adc->regs = mem;
+	adc->map_len = size;
+	return 0;
+}
+
+void uio_adc_close(struct uio_adc *adc)
+{
+	REG(adc, UIO_ADC_HC0) = UIO_ADC_CONV_DISABLE;
+	munmap((void *)adc->regs, adc->map_len);
+	close(adc->fd);
+}
+
+/* 写 CFG 后做一次硬件校准 */
+int uio_adc_setup(struct uio_adc *adc, uint32_t cfg)
+{
+	int spin = UIO_ADC_SPIN_MAX;
+
+	REG(adc, UIO_ADC_HC0) = UIO_ADC_CONV_DISABLE;
+	REG(adc, UIO_ADC_CFG) = cfg;
+	REG(adc, UIO_ADC_GS) = UIO_ADC_CALF;
+	REG(adc, UIO_ADC_GC) |= UIO_ADC_CAL;
+
+	while ((REG(adc, UIO_ADC_GC) & UIO_ADC_CAL) && --spin)
+		;
+	if (!spin || (REG(adc, UIO_ADC_GS) & UIO_ADC_CALF)) {
+		printf("ADC calibration failed\r\n");
+		return -1;
+	}
+
+	/* 校准结束也会置 COCO，读一次 R0 清掉 */
+	(void)REG(adc, UIO_ADC_R0);
+	return 0;
+}
+
+int uio_adc_read_poll(struct uio_adc *adc, int chan)
+{
+	int spin = UIO_ADC_SPIN_MAX;
+
+	REG(adc, UIO_ADC_HC0) = chan;
+	while (!(REG(adc, UIO_ADC_HS) & UIO_ADC_COCO0))
+		if (!--spin)
+			return -1;
+
+	return REG(adc, UIO_ADC_R0) & 0xfff;
+}
+
+int uio_adc_read_irq(struct uio_adc *adc, int chan)
+{
+	uint32_t on = 1, count;
+
+	/* 先打开中断，再启动转换 */
+	if (write(adc->fd, &on, sizeof(on)) != sizeof(on))
+		return -1;
+
+	REG(adc, UIO_ADC_HC0) = UIO_ADC_AIEN | chan;
+	if (read(adc->fd, &count, sizeof(count)) != sizeof(count))
+		return -1;
+
+	/* 读 R0 清 COCO，中断源在下次打开之前已经撤掉 */
+	return REG(adc, UIO_ADC_R0) & 0xfff;
+}
@@ -0,0 +1,41 @@
+#ifndef _UIO_ADC_H
+#define _UIO_ADC_H
+
+#include "stdint.h"
+
+/*
+ * 通过 platform-example-basic.c (UIO) 直接操作 i.MX6ULL ADC 寄存器
+ * 寄存器偏移和位定义同 drivers/iio/adc/imx6ull-adc.c
+ */
+#define UIO_ADC_HC0		0x00
+#define UIO_ADC_HS		0x08
+#define UIO_ADC_R0		0x0c
+#define UIO_ADC_CFG		0x14
+#define UIO_ADC_GC		0x18
+#define UIO_ADC_GS		0x1c
+
+#define UIO_ADC_AIEN		(1 << 7)
+#define UIO_ADC_COCO0		0x1
+#define UIO_ADC_CONV_DISABLE	0x1f
+#define UIO_ADC_CAL		0x80
+#define UIO_ADC_CALF		0x2
+
+/* 12 位，ipg 时钟 /2 再 4 分频 (66MHz / 8 = 8.25MHz)，短采样，不平均 */
+#define UIO_ADC_CFG_DEFAULT	(0x08 | 0x40 | 0x01)
+
+struct uio_adc {
+	int fd;
+	volatile uint32_t *regs;
+	size_t map_len;
+};
+
+int uio_adc_open(struct uio_adc *adc, const char *dev);
+void uio_adc_close(struct uio_adc *adc);
+int uio_adc_setup(struct uio_adc *adc, uint32_t cfg);
+
+/* 启动一次转换后忙等 COCO，整个过程没有系统调用 */
+int uio_adc_read_poll(struct uio_adc *adc, int chan);
+/* 启动一次转换后在 UIO 的中断 fd 上睡眠等待 */
+int uio_adc_read_irq(struct uio_adc *adc, int chan);
+
+#endif
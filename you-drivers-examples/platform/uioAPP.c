@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include "stdio.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "sched.h"
+#include "sys/mman.h"
+#include "uio-adc.h"
+
+/*
+ * 用法: ./uioAPP poll /dev/uio0 <通道> <次数>
+ *       ./uioAPP irq  /dev/uio0 <通道> <次数>
+ *       ./uioAPP iio  /sys/bus/iio/devices/iio:device0/in_voltage1_raw <次数>
+ *
+ * 每次取一个样本，统计每个样本的耗时。进程绑到 CPU0、SCHED_FIFO 90、锁内存，
+ * poll 是纯用户态忙等，irq 每个样本一次 write + read，
+ * iio 是 imx6ull-adc 驱动的 sysfs 读取 (另一个设备树里用 IIO 驱动时测)
+ */
+static void rt_setup(void)
+{
+	struct sched_param param = { .sched_priority = 90 };
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		perror("sched_setaffinity");
+	if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+		perror("sched_setscheduler");
+	mlockall(MCL_CURRENT | MCL_FUTURE);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int iio_read(int fd)
+{
+	char buf[16];
+	int len;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+	return atoi(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	struct uio_adc adc;
+	long long t0, ns, min_ns = -1, max_ns = 0, sum_ns = 0;
+	int iio, chan = 0, val = 0, fd = -1;
+	unsigned long i, loops;
+
+	if (argc < 4) {
+		printf("Usage: %s poll|irq <uio dev> <chan> <loops>\r\n", argv[0]);
+		printf("       %s iio <in_voltageX_raw> <loops>\r\n", argv[0]);
+		return -1;
+	}
+
+	iio = !strcmp(argv[1], "iio");
+	if (iio) {
+		loops = strtoul(argv[3], NULL, 0);
+		fd = open(argv[2], O_RDONLY);
+		if (fd < 0) {
+			printf("can't open file %s\r\n", argv[2]);
+			return -1;
+		}
+	} else {
+		if (argc != 5) {
+			printf("Usage: %s poll|irq <uio dev> <chan> <loops>\r\n",
+				argv[0]);
+			return -1;
+		}
+		chan = atoi(argv[3]);
+		loops = strtoul(argv[4], NULL, 0);
+		if (uio_adc_open(&adc, argv[2]) ||
+			uio_adc_setup(&adc, UIO_ADC_CFG_DEFAULT))
+			return -1;
+	}
+
+	rt_setup();
+
+	for (i = 0; i < loops; i++) {
+		t0 = now_ns();
+		if (iio)
+			val = iio_read(fd);
+		else if (!strcmp(argv[1], "poll"))
+			val = uio_adc_read_poll(&adc, chan);
+		else
+			val = uio_adc_read_irq(&adc, chan);
+		ns = now_ns() - t0;
+
+		if (val < 0) {
+			printf("read failed\r\n");
+			break;
+		}
+		sum_ns += ns;
+		if (min_ns < 0 || ns < min_ns)
+			min_ns = ns;
+		if (ns > max_ns)
+			max_ns = ns;
+	}
+
+	if (i)
+		printf("%s: %lu samples, last %d, min %lld avg %lld max %lld ns\r\n",
+			argv[1], i, val, min_ns, sum_ns / (long long)i, max_ns);
+
+	if (iio)
+		close(fd);
+	else
+		uio_adc_close(&adc);
+	return 0;
+}